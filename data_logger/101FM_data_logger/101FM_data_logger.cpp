@@ -20,25 +20,16 @@
 // Do not remove the include below
 #include "101FM_data_logger.h"
 
-#define TCP_BUFF_MAX 160 // TCP buffer size reduced to save AVR SRAM for other uses
-
 #define TCP_FLAGS_FIN_V 1 //as declared in net.h
 #define TCP_FLAGS_ACK_V 0x10 //as declared in net.h
 
 #define EEPROM_DEV_HEADER 0x50	// eeprom device where data header for the log is stored. This is where channel names are also stored
 // channel names are stored from 0x0000 to 0x0f80. Each character is stored at adjacent bytes in the available 128 bytes in a page.
-// data header is stored from 0xffff to 0x1000. This is also written into a full page (128 bytes) and the rest is kept blank.
+// data header is stored from 0xffff to 0x2000, 0x1000 to 0x1fff being the /selftest scratch area. This is also written into a full page (128 bytes) and the rest is kept blank.
 #define EEPROM_DEV_DATA 0x51	// eeprom with this I²C address stores log data. Each log entry has 64 bytes of storage. Each page will contain two log entries.
 
-#define INTPIN0 (1 << PD2) // interrupt pin connected to MCP23017 at 0x20
-#define INTPIN1 (1 << PD3) // interrupt pin connected to MCP23017 at 0x21
-
 volatile uint8_t portdhistory = 0xff; // This is where the history of the interrupt pins is kept so that we can detect a change
 
-#define EEPLED (1 << PD4)  // this is an on-board LED. It will also show any activity on EEPROM
-#define SYSLED (1 << PD5) // this LED is for showing the device health. It should blink ~50ms in each ~1600ms on normal operation. it is mounted on the front wall in 1U rack
-#define NETLED (1 << PD6) // this LED serves as an indicator for network activity
-
 volatile uint32_t beatsysint = 1; // counter for heartbeat LED
 
 I2C_eeprom ee_h(EEPROM_DEV_HEADER);
@@ -48,8 +39,6 @@ static byte myip[] = { 192, 168, 2, 2 };
 static byte gwip[] = { 192, 168, 2, 1 };
 static byte mymac[] = { 0x74, 0x69, 0x69, 0xD1, 0x2F, 0x38 };
 
-byte Ethernet::buffer[TCP_BUFF_MAX]; // tcp ip send and receive buffer
-
 const char txt_header_404[] PROGMEM
 = "HTTP/1.0 404 NOT FOUND\r\nPowered-By: avr-gcc\r\nContent-Type: text/plain\r\n\r\n"; // TCP header for 404 status stored at Flash memory.
 const char txt_header_400[] PROGMEM
@@ -60,6 +49,8 @@ const char txt_header_200[] PROGMEM
 const char txt_body_404[] PROGMEM= "page not found"; // TCP body for 404 status stored at Flash memory.
 const char txt_body_400[] PROGMEM= "bad request"; // TCP body for 400 status stored at Flash memory.
 const char txt_body_busy[] PROGMEM = "busy"; // TCP body to be used as the response when the system is busy doing other tasks.
+const char txt_body_no_data[] PROGMEM = "no data";
+const char txt_body_done[] PROGMEM = "done\n";
 const char txt_body_time_updated[] PROGMEM = "time updated\n";
 const char txt_body_interrupted[] PROGMEM = "\ninterrupted!\n";
 
@@ -67,15 +58,40 @@ const char txt_body_interrupted[] PROGMEM = "\ninterrupted!\n";
 Adafruit_MCP23017 mcp0, mcp1;
 
 volatile boolean awakenByInterrupt0 = false, awakenByInterrupt1 = false; // Flags those get set when there is an interrupt on corresponding MCP23017 chips.
-
-char buf_prog[41]; // Temporary buffer to be used to store words read from Flash (PROGMEM).
-char buf[65];
-
-volatile struct DataHeader *dh = (struct DataHeader*) malloc(sizeof(struct DataHeader)); // DataHeader global variable
+volatile uint32_t int_tick[2]; // micros() at the falling edge of INT line of each bank
+
+// Captured interrupts (INTF + INTCAP snapshots) waiting to be logged. Filled either by handleInterrupt() or, with
+// EXPANDER_SOFT_I2C, straight from the Timer2 ISR. Drained by loop().
+volatile struct Capture capq[CAPTURE_QUEUE_LEN];
+volatile uint8_t capq_head = 0, capq_tail = 0;
+volatile uint16_t capq_drops = 0; // captures lost due to a full queue
+volatile uint16_t capq_errors = 0; // captures lost due to a failed read of the expander
+volatile uint32_t capture_lat_max = 0; // worst μs seen between the INT falling edge and the capture being queued
+
+#ifdef EXPANDER_SOFT_I2C
+SoftI2C expbus(&PORTC, &DDRC, &PINC, EXPANDER_SDA, EXPANDER_SCL); // bus dedicated to MCP23017s
+volatile uint8_t capture_bank; // bank being read by the transaction in flight
+volatile uint8_t capture_pending = 0; // bit n is set when bank n fell while the bus was busy
+uint8_t capture_regs[4]; // INTFA, INTFB, INTCAPA, INTCAPB
+#endif
+
+struct LogStream stream; // the /log or /dump reply being sent
+struct HashReply hashes; // the /hashes reply being prepared
+struct RecStream rec_stream; // the /rec reply being sent
+
+static struct DataHeader dh_store;
+volatile struct DataHeader *dh = &dh_store; // DataHeader global variable
 
 volatile uint16_t dh_addr = 0xff80;
 struct ts t;
-uint8_t dh_block[9];
+#ifndef LOG_BINARY
+uint8_t dh_dirty = 0; // dh holds records not yet committed to the header EEPROM
+uint32_t dh_syncs = 0; // header writes
+uint32_t dh_records = 0; // records written
+static uint16_t dh_pend_id[LOG_GROUP_MAX]; // events of the batch, reported to metrics_commit() by log_sync()
+static uint32_t dh_pend_tick[LOG_GROUP_MAX];
+static uint8_t dh_pend = 0;
+#endif
 
 /**
  * Arduino setup function.
@@ -103,14 +119,15 @@ void setup() {
 
     Serial.println("Setting up");	// for debugging
 
+    uint32_t unix_tm_inv = 0xffffffff;
     // START DATA HEADER SEARCH
     // We have implemented simple wear leveling on write_data_header() so that whenever a new log is written to DATA eeprom
     // the new header data is written to HEADER eeprom at an incremental address location. When power reset happens we have
     // no clue where the latest data header is written to. So we are navigating through all available space for HEADER data
     // and find out what the most recent address is by using the inv(unixtime) written at the fist 4 bytes (uint32_t).
-    uint32_t unix_tm_inv = 0xffffffff;
     uint32_t val;
     uint16_t addr = 0xff80;
+    uint8_t dh_block[8];
     do {
         ee_h.readBlock(addr, (uint8_t*) dh_block, 8);	// read first 8 bytes in which we store header data
         val = (uint32_t) dh_block[0];
@@ -122,26 +139,50 @@ void setup() {
             dh_addr = addr;
         }
         addr -= 0x80;	// go to next available page
-    } while (addr > 0x0f80);	// check within these bounds
+    } while (addr >= SELFTEST_END);	// check within these bounds
+
+    if (ee_h.readByte(HEADER_MOVED_ADDR) != 0) { // the self test scratch area may still hold the newest header
+        uint16_t found = 0;
+        for (addr = SELFTEST_END - 0x80; addr >= SELFTEST_START; addr -= 0x80) {
+            ee_h.readBlock(addr, (uint8_t*) dh_block, 8);
+            val = (uint32_t) dh_block[0];
+            val |= (uint32_t) ((uint32_t) dh_block[1] << 8);
+            val |= (uint32_t) ((uint32_t) dh_block[2] << 16);
+            val |= (uint32_t) ((uint32_t) dh_block[3] << 24);
+            if (val < unix_tm_inv) { // strictly newer, blank slots never win
+                unix_tm_inv = val;
+                found = addr;
+            }
+        }
+        if (found) { // copy it into the next slot, where write_data_header() would have put it
+            ee_h.readBlock(found, (uint8_t*) dh_block, 8);
+            dh_addr = dh_addr == SELFTEST_END ? 0xff80 : dh_addr - 0x80;
+            if (ee_h.writeBlock(dh_addr, (uint8_t*) dh_block, 8)) {
+                Serial.println("error writing data to ee_h!");
+            }
+        }
+        ee_h.writeByte(HEADER_MOVED_ADDR, 0);
+    }
 
     // END DATA HEADER SEARCH
 
-    read_data_header();	// load the data header to the RAM
-
     Serial.print("HDER: 0x");
     Serial.println(dh_addr, 16);
+#if LOG_BACKEND == LOG_BACKEND_EEPROM
+    read_data_header();	// load the data header to the RAM
+
     Serial.print("DH_T: ");
     Serial.println(dh->t);
+#endif
 
     Timer1.detachInterrupt();	// detach timer1 from previous function
     PORTD &= ~SYSLED; // turn off SYSLED and SYSLEDEXT as they may be ON by now
     Timer1.initialize(50000); 	// initialize timer1 to 50ms
     Timer1.attachInterrupt(toggleNET); 	// attach timer1 to toggle NETLED since below we are going to initialize network adapter
 
-    if (!ether.begin(sizeof Ethernet::buffer, mymac, 10)) { // We have connected the chip select on digital 9. This will result in zero upon failure of network adaptor based on EN28J60
+    if (!net_begin(mymac, myip, gwip)) { // This will result in zero upon failure of the network adaptor
         Serial.println("Ethernet failed!"); // send error through terminal and keep beating the NETLED
     } else {
-        ether.staticSetup(myip, gwip);
 
         Timer1.detachInterrupt(); // We are done setting up the network. This stops blinking NETLED.
         PORTD &= ~NETLED;	// turns off NETLED
@@ -150,8 +191,27 @@ void setup() {
 
         Serial.println("Ethernet started");
 
+#ifdef LOG_BINARY
+        if (binlog_begin()) {
+            struct LogRecord r;
+            if (binlog_read(binlog_head() - 1, &r)) {
+                unix_tm_inv = 0xffffffff - r.time; // so that the RTC is checked against the newest record below
+            }
+            chain_begin();
+            Serial.print("HEAD: ");
+            Serial.println(binlog_head());
+        } else {
+            Serial.println("Log failed!");
+        }
+#endif
+
+#ifdef EXPANDER_SOFT_I2C
+        mcp0.begin(0, &expbus);	// same as below but over the bit-banged expander bus
+        mcp1.begin(1, &expbus);
+#else
         mcp0.begin(0);	// initializes mcp0 object to refer to the MCP23017 at address 0x20. This chip handles BANK0
         mcp1.begin(1);	// 0x21. This handles BANK1
+#endif
 
         // We mirror INTA and INTB, so that only one line is required between MCP23017 and AVR for int reporting
         // The INTA/B will not be Floating
@@ -172,6 +232,8 @@ void setup() {
         mcp0.setupInterrupts(true, false, LOW);
         mcp1.setupInterrupts(true, false, LOW);
 
+        group_begin(); // load channel groups and their current values
+
         DS3231_get(&t); // Read the time from DS3231 into struct t. This is to test if the RTC is fine.
 
         char buf[128];
@@ -186,6 +248,10 @@ void setup() {
         Timer1.initialize(150000);
         Timer1.attachInterrupt(beatSYS);
 
+#ifdef POWERFAIL_ADC
+        powerfail_begin(); // last-gasp flush of the log on a supply drop
+#endif
+
         sei();
 
         if ((0xffffffff - unix_tm_inv) > t.unixtime) { // check if we are getting an invalid time from RTC. A malfunctioning EEPROM also can be a reason
@@ -202,90 +268,148 @@ void setup() {
  * This gets executed over and over again until the chip is powered up and no hangs occur within the program.
  */
 void loop() {
-
+    uint32_t loop_start = micros();
+    uint16_t drops = capq_drops;
+    char cause[STALL_CAUSE_LEN + 1];
+    cause[0] = '-';
+    cause[1] = 0;
+#ifdef POWERFAIL_ADC
+    powerfail_poll(); // last gasp if the supply is failing. here and between records nothing is half done.
+#endif
+
+#ifdef EXPANDER_SOFT_I2C
+    // Captures are read from the ISR. An INT line still low while the bus is idle means a capture failed on the
+    // bus (the chip keeps INT low until INTCAP is read) so kick it again from here.
+    if (!(PIND & INTPIN0) && !expbus.busy()) {
+        cli();
+        capture_start(0);
+        sei();
+    }
+    if (!(PIND & INTPIN1) && !expbus.busy()) {
+        cli();
+        capture_start(1);
+        sei();
+    }
+#else
     // Check each of the interrupt flags and act accordingly.
-    // If a flag is set we should first unregister interrupts so that we can work on the interrupt without problem.
-    // This also helps us get rid of bouncing issues on switches.
-    // Finally re-attach interrupt to corresponding pin and function.
+    // If a flag is set we capture the interrupt registers of the chip which also clears the interrupt on it.
     if (awakenByInterrupt0) {
         handleInterrupt(&mcp0, &awakenByInterrupt0);
     }
 
-    // Check each of the interrupt flags and act accordingly.
-    // If a flag is set we should first unregister interrupts so that we can work on the interrupt without problem.
-    // This also helps us get rid of bouncing issues on switches.
-    // Finally re-attach interrupt to corresponding pin and function.
     if (awakenByInterrupt1) {
         handleInterrupt(&mcp1, &awakenByInterrupt1);
     }
+#endif
+
+    // Log everything captured so far.
+    struct Capture c;
+    while (capture_pop(&c)) {
+        recorder_capture(&c);
+        handleCapture(&c);
+    }
+    group_poll(); // log channel groups which have settled
+#ifndef LOG_BINARY
+    log_sync(); // one header write for everything logged above
+#endif
+    selftest_poll(); // inject synthetic events while a /selftest runs
+#ifdef LOG_BINARY
+    binlog_poll(); // nothing to log at the moment. good time for background work such as migrating hot records.
+#endif
+
+#ifdef POWERFAIL_ADC
+    powerfail_poll();
+#endif
 
     // recieve data from Ethernet card
-    word pos = ether.packetLoop(ether.packetReceive());
+    char* data = net_request();
     // check if valid tcp data is received
-    if (pos) {
+    if (data) {
         // WOW! we have got some data.. Let's go ahead and check them out...
 //		digitalWrite(NETLED, HIGH);
         PORTD |= NETLED;
-        char* data = (char *) Ethernet::buffer + pos;
+        strncpy(cause, data, STALL_CAUSE_LEN); // the reply is written over the request
+        cause[STALL_CAUSE_LEN] = 0;
         if (strncmp("GET / ", data, 6) == 0) {
             responseLog(data);
         } else if (strncmp("GET /log ", data, 9) == 0) { // this is the real deal. Someone has requested to check the log.
             responseLog(data);
+        } else if (strncmp("GET /sub?t=", data, 11) == 0) { // live events matching a topic filter. GET /sub?t=1/+/1
+            responseSubscribe(data + 11);
         } else if (strncmp("GET /dump ", data, 10) == 0) { // Well... this is going to be slow sometimes. Because reading the whole log is not a good idea.
-            ether.httpServerReplyAck();
-            memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-            ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-            TCP_FLAGS_ACK_V);
-            read_data_header();
-            char tmpbuff[66];
-            uint16_t addra = dh->a;
-            uint16_t addrb = dh->b;
-            tmpbuff[64] = 0x0a; // new line character at end - 1. end should be NULL (\0)
-            if (addra != addrb) {
-                while (addra != addrb) {
-                    ee_d.readBlock(addra - 0x0040, (uint8_t*) tmpbuff, 0x40);
-                    addra -= 0x40;
-                    memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-                    ether.httpServerReply_with_flags(sizeof tmpbuff - 1, (addra == addrb) ?
-                    TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V :
-                                                                                            TCP_FLAGS_ACK_V); // Send final packet with FIN which ends the TCP transmission only if this is the last packet.
-                }
+            responseStream(0, 0xff, 0);
+#ifdef LOG_BINARY
+        } else if (strncmp("GET /log?ch=b", data, 13) == 0) { // the newest records of one channel. GET /log?ch=b1c4 for BANK 1 pin 4
+            char tmp[2];
+            tmp[1] = '\0';
+            tmp[0] = data[13];
+            uint8_t bank = strtoul(tmp, NULL, 16);
+            tmp[0] = data[15];
+            uint8_t pin = strtoul(tmp, NULL, 16);
+            if (data[14] == 'c' && data[16] == ' ' && bank < 2) {
+                responseStream(0x20, bank, pin);
             } else {
-                sprintf(tmpbuff, "no data");
-                tmpbuff[7] = 0x0a; // new line character at end - 1. end should be NULL (\0)
-                memcpy(ether.tcpOffset(), tmpbuff, 8);
-                ether.httpServerReply_with_flags(7,
-                TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+                responseStatus(txt_header_400, txt_body_400);
             }
+#endif
         } else if (strncmp("GET /addr ", data, 10) == 0) { // For debugging purposes. This results in the DataHeader printed out via HTTP.
-            ether.httpServerReplyAck();
-            memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-            ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-            TCP_FLAGS_ACK_V);
+            HttpReply out;
+            out.begin();
+            out.write_P(txt_header_200);
+#ifdef LOG_BINARY
+            out.printf("SEQ %lu %lu\n", binlog_head(), binlog_tail()); // head and tail sequence numbers
+#else
+            log_sync();
             read_data_header();
-            char tmpbuff[11];
-            sprintf(tmpbuff, "HDER %04x", dh_addr);
-            tmpbuff[9] = 0x0a;
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1,
-            TCP_FLAGS_ACK_V);
-            sprintf(tmpbuff, "%04x %04x", dh->a, dh->b);
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1,
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V);
+            out.printf("HDER %04x\n%04x %04x\n", dh_addr, dh->a, dh->b);
+#endif
+            out.printf("CAPL %lu DROP %u ERR %u", capture_lat_max, capq_drops, capq_errors); // worst capture latency in μs, dropped and failed captures
+            out.close();
+        } else if (strncmp("GET /selftest?", data, 14) == 0) { // GET /selftest?rate=50&count=200&pattern=w starts a load self test
+            char *rate = strstr(data, "rate=");
+            char *count = strstr(data, "count=");
+            char *pattern = strstr(data, "pattern=");
+            if (rate && count && pattern && selftest_start(atoi(rate + 5), atoi(count + 6), pattern[8])) {
+                responseSelftest();
+            } else {
+                responseStatus(txt_header_400, txt_body_400);
+            }
+        } else if (strncmp("GET /selftest ", data, 14) == 0) { // progress or results of the last self test
+            responseSelftest();
+        } else if (strncmp("GET /hashes?", data, 12) == 0) { // GET /hashes?from=0&to=63 block hashes for reconciling a copy of the log
+            char *from = strstr(data, "from=");
+            char *to = strstr(data, "to=");
+            uint8_t f = from ? parse_block(from + 5) : 0;
+            uint8_t l = to ? parse_block(to + 3) : HASH_BLOCKS - 1;
+            if (f < HASH_BLOCKS && l < HASH_BLOCKS && f <= l) {
+                responseHashes(f, l);
+            } else {
+                responseStatus(txt_header_400, txt_body_400);
+            }
+        } else if (strncmp("GET /blk?n=", data, 11) == 0) { // raw content of one block in hex
+            uint8_t n = parse_block(data + 11);
+            if (n < HASH_BLOCKS) {
+                responseBlock(n);
+            } else {
+                responseStatus(txt_header_400, txt_body_400);
+            }
+        } else if (strncmp("GET /rec?on ", data, 12) == 0) { // start the input recorder. this empties it.
+            recorder_enable(1);
+            responseRecorder();
+        } else if (strncmp("GET /rec?stall ", data, 15) == 0) { // start the input recorder and stop it at the next worst loop() pass
+            recorder_enable(2);
+            loop_stall_reset(); // the worst pass from now on, not since boot
+            responseRecorder();
+        } else if (strncmp("GET /rec?off ", data, 13) == 0) { // stop the input recorder
+            recorder_enable(0);
+            responseRecorder();
+        } else if (strncmp("GET /rec ", data, 9) == 0) { // download the input recorder
+            responseRecorder();
+        } else if (strncmp("GET /metrics ", data, 13) == 0) { // event latency histograms
+            responseMetrics();
         } else if (strncmp("GET /clr ", data, 9) == 0) { // clear data logs
-            dh->b = dh->a; // To clear the logs. This doesn't clear the actual logs at all, rather acts like a deletion of a file from a hard disk  where only table header (in the first EEPROM chip) is modified.
-            write_data_header();
-            ether.httpServerReplyAck();
-            memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-            ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-            TCP_FLAGS_ACK_V);
-            char tmpbuff[6];
-            sprintf(tmpbuff, "done");
-            tmpbuff[4] = 0x0a;
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1,
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+            log_clear();
+            responseStatus(txt_header_200, txt_body_done);
         } else if (strncmp("GET /time?", data, 10) == 0) { // to set the time
             char year[5];
             memcpy(year, &data[10], 4);
@@ -313,32 +437,20 @@ void loop() {
 
             DS3231_set(t);
 
-            DS3231_get(&t); // receive time from RTC
-            ether.httpServerReplyAck();
-            memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-            ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-            TCP_FLAGS_ACK_V);
-            memcpy_P(ether.tcpOffset(), txt_body_time_updated, sizeof txt_body_time_updated);
-            ether.httpServerReply_with_flags(sizeof txt_body_time_updated - 1,
-            TCP_FLAGS_ACK_V);
-            char tmpbuff[20];
-            tmpbuff[19] = 0x0a;
-            sprintf(tmpbuff, "%04d-%02d-%02d %02d:%02d:%02d", t.year, t.mon, t.mday, t.hour, t.min, t.sec);
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1,
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+            rtc_get(&t); // receive time from RTC
+            HttpReply out;
+            out.begin();
+            out.write_P(txt_header_200);
+            out.write_P(txt_body_time_updated);
+            out.printf("%04d-%02d-%02d %02d:%02d:%02d", t.year, t.mon, t.mday, t.hour, t.min, t.sec);
+            out.close();
         } else if (strncmp("GET /time ", data, 10) == 0) { // to get the time
-            DS3231_get(&t); // receive time from RTC
-            ether.httpServerReplyAck();
-            memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-            ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-            TCP_FLAGS_ACK_V);
-            char tmpbuff[20];
-            tmpbuff[19] = 0x0a;
-            sprintf(tmpbuff, "%04d-%02d-%02d %02d:%02d:%02d", t.year, t.mon, t.mday, t.hour, t.min, t.sec);
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1,
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+            rtc_get(&t); // receive time from RTC
+            HttpReply out;
+            out.begin();
+            out.write_P(txt_header_200);
+            out.printf("%04d-%02d-%02d %02d:%02d:%02d", t.year, t.mon, t.mday, t.hour, t.min, t.sec);
+            out.close();
         } else if (strncmp("GET /cnl?b", data, 10) == 0) { // to set a name for a specified channel
             String s = data;
             uint8_t end = s.indexOf(" HTTP/1.");
@@ -355,11 +467,6 @@ void loop() {
                 memcpy(tmp, &data[12], 1); // get index of the channel from GET parameters
                 addr += strtoul(tmp, NULL, 16) * 0x0080; // add pin address to the above offset to get actual address to store the name
 
-                ether.httpServerReplyAck();
-                memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-                ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-                TCP_FLAGS_ACK_V);
-
                 char c_name[end - 13 + 1];
 
                 s.substring(13).toCharArray(c_name, end - 12);
@@ -368,94 +475,327 @@ void loop() {
                 sprintf(writebuff, "%40s", c_name);
                 ee_h.writeBlock(addr, (uint8_t*) writebuff, 40);
 
-                char tmpbuff[47];
-                for (uint8_t x = 0; x < 0x20; x++) {
-                    ee_h.readBlock(0x0080 * (uint16_t) x, (uint8_t*) writebuff, 40);
-                    sprintf(tmpbuff, "b%xc%x %40s", x / 0x10, x % 0x10, writebuff);
-                    tmpbuff[45] = 0x0a;
-                    memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-                    ether.httpServerReply_with_flags(sizeof tmpbuff - 1, x == 0x1f ? TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V : TCP_FLAGS_ACK_V); // Send final packet with FIN which ends the TCP transmission.
-                }
+                responseChannels();
             } else { // invalid / incomplete format on the request for setting channel name
-                ether.httpServerReplyAck(); // send ack to the request
-                memcpy_P(ether.tcpOffset(), txt_header_400, sizeof txt_header_400);
-                ether.httpServerReply_with_flags(sizeof txt_header_400 - 1,
-                TCP_FLAGS_ACK_V);
-                memcpy_P(ether.tcpOffset(), txt_body_400, sizeof txt_body_400);
-                ether.httpServerReply_with_flags(sizeof txt_body_400 - 1,
-                TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+                responseStatus(txt_header_400, txt_body_400);
             }
 
+        } else if (strncmp("GET /grp?b", data, 10) == 0) { // to define a channel group. GET /grp?b0c4w3 groups pins 4 to 6 of BANK 0, w1 ungroups
+            char tmp[2];
+            tmp[1] = '\0';
+            tmp[0] = data[10];
+            uint8_t bank = strtoul(tmp, NULL, 16);
+            tmp[0] = data[12];
+            uint8_t pin = strtoul(tmp, NULL, 16);
+            tmp[0] = data[14];
+            uint8_t width = strtoul(tmp, NULL, 16);
+            if (data[11] == 'c' && data[13] == 'w' && group_set(bank, pin, width)) {
+                responseStatus(txt_header_200, txt_body_done);
+            } else {
+                responseStatus(txt_header_400, txt_body_400);
+            }
         } else if (strncmp("GET /cnl?reset ", data, 15) == 0) { // resets channel names to defaults
             char writebuff[41];
 
             for (uint8_t x = 0; x < 0x20; x++) {
                 sprintf(writebuff, "%36sb%xc%x", "", x / 0x10, x % 0x10);
-                ee_h.writeBlock(0x0080 * (uint16_t) x, (uint8_t*) writebuff, 40);
+                writebuff[40] = 0xff; // no group
+                ee_h.writeBlock(0x0080 * (uint16_t) x, (uint8_t*) writebuff, 41);
             }
+            group_begin();
 
             responseChannels();
         } else if (strncmp("GET /cnl ", data, 9) == 0) { // response names of all channels
             responseChannels();
         } else { // Page not found. Yes 404.
-            ether.httpServerReplyAck(); // send ack to the request
-            memcpy_P(ether.tcpOffset(), txt_header_404, sizeof txt_header_404);
-            ether.httpServerReply_with_flags(sizeof txt_header_404 - 1,
-            TCP_FLAGS_ACK_V);
-            memcpy_P(ether.tcpOffset(), txt_body_404, sizeof txt_body_404);
-            ether.httpServerReply_with_flags(sizeof txt_body_404 - 1,
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+            responseStatus(txt_header_404, txt_body_404);
         }
         PORTD &= ~NETLED;
     }
+
+#ifdef POWERFAIL_ADC
+    powerfail_poll();
+#endif
+    log_stream_poll(); // next few lines of a /log or /dump reply
+    hashes_poll(); // next few block reads of a /hashes reply
+    rec_stream_poll(); // next few entries of a /rec reply
+    sub_poll(); // events queued for /sub clients
+    loop_time(loop_start, capq_drops - drops, cause);
 }
 void responseLog(char *data) {
-    ether.httpServerReplyAck();
-    memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-    ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-    TCP_FLAGS_ACK_V);
-    read_data_header();
-    char tmpbuff[66];
-    uint16_t addra = dh->a;
-    uint16_t addrb = dh->b;
-    tmpbuff[64] = 0x0a;
-    if (addra != addrb) {
-        uint16_t i = 0x00;
-        while (addra != addrb) {
-            ee_d.readBlock(addra - 0x0040, (uint8_t*) tmpbuff, 0x40);
-            addra -= 0x40;
-            memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-            ether.httpServerReply_with_flags(sizeof tmpbuff - 1, (i == 0x1f || addra == addrb) ?
-            TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V :
-                                                                                                 TCP_FLAGS_ACK_V); // Send final packet with FIN which ends the TCP transmission only if this is the last packet.
-            if (i == 0x1f || addra == addrb) {
-                break;
+    responseStream(0x20, 0xff, 0);
+}
+
+/**
+ * Replies with header followed by body, both in program space, as one segment and ends the reply.
+ */
+void responseStatus(PGM_P header, PGM_P body) {
+    HttpReply out;
+    out.begin();
+    out.write_P(header);
+    out.write_P(body);
+    out.close();
+}
+
+/**
+ * Starts replying with the newest lines of the log, all of them if lines is 0, or with those of channel pin of bank
+ * only if bank is not 0xff. The lines are sent by log_stream_poll() a few at a time, so events keep being captured
+ * and logged while a slow client reads. The reply shows the log as it was when the request came in.
+ */
+void responseStream(uint16_t lines, uint8_t bank, uint8_t pin) {
+    if (stream.active) { // one stream at a time
+        responseStatus(txt_header_200, txt_body_busy);
+        return;
+    }
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+#ifdef LOG_BINARY
+    if (bank == 0xff ? log_open(&stream.cur) : chain_open(&stream.cur, bank, pin)) {
+#else
+    if (log_open(&stream.cur)) {
+#endif
+        stream.left = lines;
+        stream.active = 1;
+        out.save(stream.reply);
+    } else {
+        out.write_P(txt_body_no_data);
+        out.close();
+    }
+}
+
+/**
+ * Subscribes the client to the events matching filter, see subscribe.cpp. The connection is left open.
+ */
+void responseSubscribe(const char *filter) {
+    if (!sub_filter_valid(filter)) {
+        responseStatus(txt_header_400, txt_body_400);
+        return;
+    }
+    uint8_t reply[HTTP_REPLY_STATE_LEN];
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    out.save(reply);
+    sub_open(filter, reply);
+}
+
+/**
+ * Sends the next LOG_STREAM_BURST lines of the reply started by responseStream().
+ */
+void log_stream_poll() {
+    if (!stream.active) {
+        return;
+    }
+    HttpReply out;
+    out.restore(stream.reply);
+    for (uint8_t i = 0; i < LOG_STREAM_BURST && stream.active; i++) {
+        char *line = out.reserve(65);
+        if (log_prev(&stream.cur, line)) { // straight into the packet
+            line[64] = 0x0a;
+            out.commit(65);
+            if (stream.left && !--stream.left) {
+                stream.active = 0;
             }
-            i++;
         }
+        if (stream.cur.pos == stream.cur.end) {
+            stream.active = 0;
+        }
+    }
+    if (stream.active) {
+        out.save(stream.reply);
     } else {
-        sprintf(tmpbuff, "no data");
-        tmpbuff[7] = 0x0a;
-        memcpy(ether.tcpOffset(), tmpbuff, 8);
-        ether.httpServerReply_with_flags(7,
-        TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V); // Send final packet with FIN which ends the TCP transmission.
+        out.close(); // Send final packet with FIN which ends the TCP transmission.
     }
 }
 void responseChannels() {
-    ether.httpServerReplyAck();
-    memcpy_P(ether.tcpOffset(), txt_header_200, sizeof txt_header_200);
-    ether.httpServerReply_with_flags(sizeof txt_header_200 - 1,
-    TCP_FLAGS_ACK_V);
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
     char writebuff[41];
-    char tmpbuff[47];
+    writebuff[40] = 0;
     for (uint8_t x = 0; x < 0x20; x++) {
         ee_h.readBlock(0x0080 * (uint16_t) x, (uint8_t*) writebuff, 40);
-        sprintf(tmpbuff, "b%xc%x %40s", x / 0x10, x % 0x10, writebuff);
-        tmpbuff[45] = 0x0a;
-        memcpy(ether.tcpOffset(), tmpbuff, sizeof tmpbuff);
-        ether.httpServerReply_with_flags(sizeof tmpbuff - 1, x == 0x1f ?
-        TCP_FLAGS_ACK_V | TCP_FLAGS_FIN_V :
-                                                                         TCP_FLAGS_ACK_V); // Send final packet with FIN which ends the TCP transmission.
+        out.printf("b%xc%x %40s\n", x / 0x10, x % 0x10, writebuff);
+    }
+    out.close();
+}
+
+/**
+ * Prints the latency histograms. See metrics.cpp for the buckets. Each histogram line is followed by its worst
+ * value and the log position of the event that caused it.
+ */
+void responseMetrics() {
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    static const char *names[] = { "C2C", "C2D", "C2S", "C2P" }; // capture to commit in ms, commit to HTTP delivery
+                                                                  // in s, commit to serial and push delivery in ms
+    for (uint8_t i = 0; i <= DELIVER_PATHS; i++) {
+        const struct LatencyHist *h = i ? &lat_deliver[i - 1] : &lat_commit;
+        char *line = out.reserve(80);
+        uint8_t len = hist_format(h, names[i], line);
+        line[len++] = 0x0a;
+        out.commit(len);
+        out.printf("MAX %lu ID %lu\n", h->max, h->max_id); // capture to commit in μs, commit to delivery in ms
+    }
+    for (uint8_t i = 0; i < 2; i++) {
+        const struct BusTime *b = i ? &bus_name : &bus_capture;
+        out.printf("%s N %u AVG %lu MAX %lu\n", i ? "BUSN" : "BUSC", b->count,
+                b->count ? b->sum / b->count : 0, b->max); // μs on the bus per capture read and per name read
+    }
+#ifndef LOG_BINARY
+    out.printf("SYNC %lu REC %lu\n", dh_syncs, dh_records); // header writes and records written
+#endif
+#if LOG_BACKEND == LOG_BACKEND_EEPROM_SEQ
+    out.printf("HOT %u PAGE %lu REC %lu\n", binlog_hot(), tier_writes, tier_records); // records hot, page writes and records migrated
+#endif
+    out.printf("STALL %lu DROP %u %s\n", loop_stall.max, loop_stall.drops, loop_stall.cause); // longest loop() pass in μs
+    loop_stall_reset(); // since the last /metrics
+    out.printf("UNTR %u CAPL %lu DROP %u ERR %u", lat_untracked, capture_lat_max, capq_drops, capq_errors);
+    out.close();
+}
+
+/**
+ * Prints the self test report. See selftest_report() for the format.
+ */
+void responseSelftest() {
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    uint8_t len;
+    for (uint8_t n = 0; (len = selftest_report(n, out.reserve(64))); n++) {
+        out.commit(len);
+    }
+    out.close();
+}
+
+/**
+ * Parses the block number at s. Returns HASH_BLOCKS if there is none or it is out of range.
+ */
+uint8_t parse_block(const char *s) {
+    char *end;
+    unsigned long n = strtoul(s, &end, 10);
+    return end == s || n >= HASH_BLOCKS ? HASH_BLOCKS : n;
+}
+
+/**
+ * Starts the reply with the hashes of the blocks from to to. Blocks which are not cached are read back by
+ * hashes_poll() a little per loop() pass, which sends the hashes once all are known.
+ */
+void responseHashes(uint8_t from, uint8_t to) {
+    if (hashes.active) { // one at a time
+        responseStatus(txt_header_200, txt_body_busy);
+        return;
+    }
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    out.save(hashes.reply);
+    hashes.from = from;
+    hashes.to = to;
+    hashes.active = 1;
+}
+
+/**
+ * Reads back the next HASH_FILL_BURST bytes for the reply started by responseHashes(), or sends the hash of the
+ * blocks followed by the hash of every single block, 16 per line, once all are cached.
+ */
+void hashes_poll() {
+    if (!hashes.active) {
+        return;
+    }
+    if (net_closed(hashes.reply)) {
+        hashes.active = 0;
+        return;
+    }
+    if (!hash_fill(hashes.from, hashes.to)) {
+        return;
+    }
+    uint8_t from = hashes.from;
+    uint8_t to = hashes.to;
+    hashes.active = 0;
+    HttpReply out;
+    out.restore(hashes.reply);
+    out.printf("RANGE %u %u %04x\n", from, to, hash_range(from, to)); // all cached, nothing is read
+    for (uint8_t block = from;; block++) {
+        uint8_t last = block == to || (block - from) % 16 == 15;
+        out.printf(last ? "%04x\n" : "%04x ", hash_block(block));
+        if (block == to) {
+            break;
+        }
+    }
+    out.close();
+}
+
+/**
+ * Prints the raw content of a block in hex, 32 bytes per line.
+ */
+void responseBlock(uint8_t block) {
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    uint8_t raw[32];
+    for (uint16_t off = 0; off < HASH_BLOCK_SIZE; off += sizeof raw) {
+        ee_d.readBlock(block * HASH_BLOCK_SIZE + off, raw, sizeof raw);
+        char *line = out.reserve(65);
+        for (uint8_t i = 0; i < sizeof raw; i++) {
+            sprintf(line + 2 * i, "%02x", raw[i]);
+        }
+        line[64] = 0x0a;
+        out.commit(65);
+    }
+    out.close();
+}
+
+/**
+ * Starts the reply with the number of entries of the input recorder. The entries follow oldest first, sent by
+ * rec_stream_poll() a few per loop() pass. See recorder.cpp.
+ */
+void responseRecorder() {
+    if (rec_stream.active) { // one at a time
+        responseStatus(txt_header_200, txt_body_busy);
+        return;
+    }
+    HttpReply out;
+    out.begin();
+    out.write_P(txt_header_200);
+    rec_stream.first = recorder_oldest();
+    rec_stream.count = recorder_count();
+    rec_stream.n = 0;
+    out.printf("REC %u\n", rec_stream.count);
+    if (rec_stream.count) {
+        rec_stream.active = 1;
+        out.save(rec_stream.reply);
+    } else {
+        out.close();
+    }
+}
+
+/**
+ * Sends the next REC_STREAM_BURST entries of the reply started by responseRecorder().
+ */
+void rec_stream_poll() {
+    if (!rec_stream.active) {
+        return;
+    }
+    if (net_closed(rec_stream.reply)) {
+        rec_stream.active = 0;
+        return;
+    }
+    HttpReply out;
+    out.restore(rec_stream.reply);
+    for (uint8_t i = 0; i < REC_STREAM_BURST && rec_stream.n < rec_stream.count; i++) {
+        char *line = out.reserve(33);
+        recorder_format(rec_stream.first, rec_stream.n++, line);
+        line[32] = 0x0a;
+        out.commit(33);
+    }
+    if (rec_stream.n < rec_stream.count) {
+        out.save(rec_stream.reply);
+    } else {
+        rec_stream.active = 0;
+        out.close(); // Send final packet with FIN which ends the TCP transmission.
     }
 }
 
@@ -490,6 +830,7 @@ void beatSYS() {
  * To read data header from first EEPROM
  */
 void read_data_header() {
+    uint8_t dh_block[8];
     ee_h.readBlock(dh_addr, (uint8_t*) dh_block, 8);
     dh->t = (uint32_t) dh_block[0];
     dh->t |= (uint32_t) ((uint32_t) dh_block[1] << 8);
@@ -505,7 +846,8 @@ void read_data_header() {
  * To write data header into first EEPROM
  */
 void write_data_header() {
-    DS3231_get(&t);
+    uint8_t dh_block[8];
+    rtc_get(&t);
     dh->t = 0xffffffff - t.unixtime;
     dh_block[4] = (uint8_t) (dh->a & 0xff);
     dh_block[5] = (uint8_t) ((dh->a & 0xff00) >> 8);
@@ -516,7 +858,7 @@ void write_data_header() {
     dh_block[2] = (uint8_t) ((dh->t & 0xff0000) >> 16);
     dh_block[3] = (uint8_t) ((dh->t & 0xff000000) >> 24);
     dh_addr -= 0x0080;
-    if (dh_addr == 0x0f80) {
+    if (dh_addr == SELFTEST_END - 0x0080) {
         dh_addr = 0xff80;
     }
     if (ee_h.writeBlock(dh_addr, (uint8_t*) dh_block, 8)) {
@@ -525,90 +867,420 @@ void write_data_header() {
 }
 
 /**
- * Improved page write mode.
+ * Starts walking the log from the newest record. Returns 0 if the log is empty.
+ */
+uint8_t log_open(struct LogCursor *c) {
+#ifdef LOG_BINARY
+    c->pos = binlog_head();
+    c->end = binlog_tail();
+    c->epoch = 0;
+    c->bank = 0xff;
+#else
+    log_sync(); // only committed records are delivered
+    read_data_header();
+    c->pos = dh->a;
+    c->end = dh->b;
+    c->epoch = dh_records + (uint16_t) (c->end - c->pos) / 0x40; // records the writer can add before reaching end
+#endif
+    return c->pos != c->end;
+}
+
+/**
+ * Reads the next older record as a 64 character line (no terminator). Returns 0 when the oldest record is passed,
+ * or while a cursor following a channel chain is still looking for its next record.
+ *
+ * The writer never waits for a reader. Once it has overwritten the record the cursor is at, that record and all
+ * older ones are reported as a single gap line and the cursor is done.
+ */
+uint8_t log_prev(struct LogCursor *c, char *line) {
+    if (c->pos == c->end) {
+        return 0;
+    }
+    uint32_t gap = 0;
+#ifdef LOG_BINARY
+    if (c->bank != 0xff) {
+        return chain_prev(c, line);
+    }
+    if (c->pos - 1 < binlog_tail()) { // overwritten or cleared since the cursor was opened
+        gap = c->pos - c->end;
+    }
+#else
+    int32_t lost = dh_records - c->epoch; // records overwritten at end and above
+    uint16_t older = (uint16_t) (c->pos - 0x40 - c->end) / 0x40; // records between the next one and end
+    if (lost > 0 && older < (uint32_t) lost) {
+        gap = older + 1;
+    }
+#endif
+    if (gap) {
+        char tmp[65];
+        sprintf(tmp, "%-10lu %-53s", gap, "records overwritten while streaming");
+        memcpy(line, tmp, 64);
+        c->pos = c->end;
+        return 1;
+    }
+#ifdef LOG_BINARY
+    struct LogRecord r;
+    c->pos--;
+    if (binlog_read(c->pos, &r)) {
+        format_record(&r, line);
+        metrics_delivered(c->pos, DELIVER_HTTP);
+    } else {
+        char tmp[65];
+        sprintf(tmp, "%-10lu %-53s", c->pos, "corrupt record");
+        memcpy(line, tmp, 64);
+    }
+#else
+    c->pos = (uint16_t) (c->pos - 0x40); // 16 bit EEPROM address wraps around
+    ee_d.readBlock(c->pos, (uint8_t*) line, 0x40);
+    metrics_delivered(c->pos, DELIVER_HTTP);
+#endif
+    return 1;
+}
+
+/**
+ * Clears the logs. This doesn't clear the actual logs at all, rather acts like a deletion of a file from a hard disk
+ * where only the table header (or a marker) is written.
+ */
+void log_clear() {
+#ifdef LOG_BINARY
+    rtc_get(&t);
+    binlog_clear(t.unixtime);
+    chain_begin(); // nothing older is visible any more
+#else
+    log_sync();
+    dh->b = dh->a;
+    write_data_header();
+#endif
+}
+
+/**
+ * Last-gasp entry called by powerfail_poll(). Appends a power-fail record and commits the data header or the
+ * hot tier.
+ */
+void log_power_fail(uint8_t lost) {
+    rtc_get(&t);
+#ifdef LOG_BINARY
+    struct LogRecord r;
+    r.time = t.unixtime;
+    r.bank = 0xff;
+    r.pin = 0xff;
+    r.val = lost;
+    r.flags = LOG_REC_POWER;
+    binlog_append(&r, 0);
+    binlog_flush();
+#else
+    char line[65];
+    sprintf(line, "%04d-%02d-%02d %02d:%02d:%02d %40s %3u", t.year, t.mon, t.mday, t.hour, t.min, t.sec, "POWER FAIL", lost);
+    record_data_page_write_mode(line);
+    log_sync();
+#endif
+}
+
+#ifndef LOG_BINARY
+/**
+ * Group commit. Writes the data header once for all the records written since the last call, which makes them
+ * committed.
+ */
+void log_sync() {
+    if (dh_dirty) {
+        write_data_header();
+        dh_syncs++;
+        dh_dirty = 0;
+    }
+    for (uint8_t i = 0; i < dh_pend; i++) {
+        metrics_commit(dh_pend_id[i], dh_pend_tick[i]);
+    }
+    dh_pend = 0;
+}
+#endif
+
+/**
+ * CRC16 over a LogRecord except the crc field itself
+ */
+uint16_t log_record_crc(const struct LogRecord *r) {
+    uint16_t crc = 0xffff;
+    for (uint8_t i = 0; i < sizeof(struct LogRecord) - 2; i++) {
+        crc = _crc16_update(crc, ((const uint8_t*) r)[i]);
+    }
+    return crc;
+}
+
+/**
+ * Formats a binary record into the same 64 character line the EEPROM log stores. Channel name is the one at the
+ * header EEPROM at the time of reading.
+ */
+void format_record(const struct LogRecord *r, char *line) {
+    struct ts tm;
+    char name[41];
+    char tmp[65];
+    unixtime_to_ts(r->time, &tm);
+    if (r->flags & LOG_REC_POWER) {
+        sprintf(name, "%40s", "POWER FAIL");
+    } else {
+        ee_h.readBlock(CHANNEL_ADDR(r->bank, r->pin), (uint8_t*) name, 40);
+    }
+    name[40] = 0;
+    sprintf(tmp, "%04d-%02d-%02d %02d:%02d:%02d %40s ", tm.year, tm.mon, tm.mday, tm.hour, tm.min, tm.sec, name);
+    format_value(r->val, r->flags, tmp + 61);
+    memcpy(line, tmp, 64);
+}
+
+/**
+ * Formats the 3 character value column of a log line. Groups show their decoded value, power-fail markers the number
+ * of captures lost, plain channels ON/OFF.
+ */
+void format_value(uint8_t val, uint8_t flags, char *str) {
+    if (flags & (LOG_REC_GROUP | LOG_REC_POWER)) {
+        sprintf(str, "%3u", val);
+    } else {
+        sprintf(str, "%3s", val ? "ON" : "OFF");
+    }
+}
+
+/**
+ * Breaks unix time down into date and time (UTC, proleptic Gregorian). Inverse of get_unixtime() in ds3231.
+ */
+void unixtime_to_ts(uint32_t unixtime, struct ts *tm) {
+    uint32_t days = unixtime / 86400UL;
+    uint32_t secs = unixtime % 86400UL;
+    tm->hour = secs / 3600;
+    tm->min = (secs % 3600) / 60;
+    tm->sec = secs % 60;
+
+    // days since 1970-01-01 to civil date, counting eras of 400 years from 0000-03-01
+    uint32_t z = days + 719468UL;
+    uint32_t era = z / 146097UL;
+    uint32_t doe = z - era * 146097UL;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    tm->mday = doy - (153 * mp + 2) / 5 + 1;
+    tm->mon = mp < 10 ? mp + 3 : mp - 9;
+    tm->year = yoe + era * 400 + (tm->mon <= 2);
+    tm->unixtime = unixtime;
+}
+
+#ifndef LOG_BINARY
+/**
+ * Improved page write mode. Returns the status of the EEPROM write, 0 on success (see Wire.endTransmission()).
+ * The data header is left alone on failure.
  * Only writes up to 32 chars. Using this function to write more than 32 bytes is currently not supported.
  * If we are at a page boundary and try to write more bytes wrapping around will occur which is a data corruption
  * at user end. Uses page_write function  of EEPROM to make it way faster than byte write.
  * Since Arduino Wire library has max 32 bytes as its buffer let's go for 16 bytes write each cycle. That is because
  * 2 bytes are dedicated for addresses.
+ * The data header is not written here but by log_sync() once per batch of records, see record_event().
  */
 
 uint8_t record_data_page_write_mode(char* data) {
 
     PORTD |= EEPLED;	// turn on EEPLED to show eeprom usage
-    read_data_header();
-    if (ee_d.writeBlock(dh->a, (uint8_t*) data, 0x40)) {
+    if (!dh_dirty) {
+        read_data_header();
+    }
+    uint8_t status = ee_d.writeBlock(dh->a, (uint8_t*) data, 0x40);
+    if (status) {
+        hash_invalidate(dh->a);
         Serial.println("error writing data to ee_d!");
     } else {
+        hash_written(dh->a, (uint8_t*) data, 0x40);
         dh->a += 0x0040;
         if (dh->a == dh->b) {
             dh->b += 0x00040;
         }
-        write_data_header();
+        dh_records++;
+        dh_dirty++;
     }
     PORTD &= ~EEPLED;	// turn off EEPLED
-    return 1;
+    return status;
 }
+#endif
 
 /**
- * Handle registered interrupts. Below is a list of steps to follow. The implementation below is an extension upon these basic steps.
- * Look for the comments in code.
- * 1. Check which pin has been changed.
- * 2. Check the value of the pin.
- * 3. Get the time from RTC.
- * 4. Get user friendly name stored at the FLASH storage.
- * 5. Print the incident into serial (for debugging purposes).
- * 6. Record the data onto EEPROM.
- * 7. Clean the interrupt flags so that another interrupt can take place.
+ * Captures the interrupt of an MCP23017 over the TWI bus. INTF and INTCAP are read in one go which also clears the
+ * interrupt condition on the chip, then the snapshot is queued to be logged by handleCapture(). A failed read is
+ * counted in capq_errors and queues nothing.
  */
 void handleInterrupt(Adafruit_MCP23017 *mcp, volatile boolean *awakenByInterrupt) {
+    uint16_t intf, intcap;
+    *awakenByInterrupt = false; // clear before reading so that an edge after the read is not lost
+    uint32_t since = micros();
+    uint8_t ok = mcp->readInterruptCapture(&intf, &intcap);
+    bus_time(&bus_capture, since);
+    if (!ok) {
+        capq_errors++;
+    } else if (intf) {
+        capture_push(mcp->getAddr(), intf, intcap, int_tick[mcp->getAddr()]);
+    }
+}
+
+/**
+ * Handle a captured interrupt. Below is a list of steps to follow.
+ * 1. Check which pins have been changed.
+ * 2. Hand pins belonging to channel groups over to group_capture().
+ * 3. Get the time from RTC.
+ * 4. Check the value of each remaining pin and record it with record_event(), which gets the user friendly name
+ *    stored at the header EEPROM, prints the incident into serial (for debugging purposes) and records it.
+ */
+void handleCapture(struct Capture *c) {
+
+    if (c->bank & CAPTURE_SELFTEST) { // synthetic event from /selftest. no groups, no log.
+        rtc_get(&t);
+        for (uint8_t pin = 0; pin < 16; pin++) {
+            if (c->intf & (1 << pin)) {
+                record_event(c->bank & ~CAPTURE_SELFTEST, pin, (c->intcap >> pin) & 0x01, LOG_REC_TEST, c->tick);
+            }
+        }
+        return;
+    }
+
+    uint16_t intf = group_capture(c); // grouped pins are logged by group_poll() once they settle
+    if (!intf) {
+        return;
+    }
+
+    rtc_get(&t); // receive time from RTC
+
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (intf & (1 << pin)) {
+            record_event(c->bank, pin, (c->intcap >> pin) & 0x01, 0, c->tick);
+        }
+    }
+}
+
+/**
+ * Logs a single event stamped with the time in t. val is the pin value or, with LOG_REC_GROUP, the decoded value of
+ * the group starting at pin. tick is micros() at the interrupt that brought the event in.
+ */
+void record_event(uint8_t bank, uint8_t pin, uint8_t val, uint8_t flags, uint32_t tick) {
+#ifdef POWERFAIL_ADC
+    powerfail_poll(); // a burst of events must not hold off the last gasp
+#endif
+    char line[65];
+    sprintf(line, "%04d-%02d-%02d %02d:%02d:%02d ", t.year, t.mon, t.mday, t.hour, t.min, t.sec);
+    ee_h.waitEEReady(); // a write cycle still running is not bus time
+    uint32_t since = micros();
+    ee_h.readBlock(CHANNEL_ADDR(bank, pin), (uint8_t*) line + 20, 40); // name straight into its column
+    bus_time(&bus_name, since);
+    line[60] = ' ';
+    format_value(val, flags, line + 61);
+
+    uint32_t id = METRICS_NO_ID;
+    uint8_t committed = 0;
+#ifdef LOG_BINARY
+    struct LogRecord r;
+    r.time = t.unixtime;
+    r.bank = bank;
+    r.pin = pin;
+    r.val = val;
+    r.flags = flags;
+    if (flags & LOG_REC_TEST) {
+        r.seq = 0;
+        r.spare = 0xffff;
+        r.crc = log_record_crc(&r);
+        selftest_commit((uint8_t*) &r, sizeof r, tick);
+    } else if (binlog_append(&r, tick)) { // Write to the log. the backend calls metrics_commit() once it is durable
+        id = r.seq;
+        committed = 1;
+    }
+#else
+    if (flags & LOG_REC_TEST) {
+        selftest_commit((uint8_t*) line, 0x40, tick);
+    } else if (record_data_page_write_mode(line) == 0) { // Write to eeprom
+        id = (uint16_t) (dh->a - 0x40);
+        committed = 1;
+        dh_pend_id[dh_pend] = id;
+        dh_pend_tick[dh_pend++] = tick;
+        if (dh_pend >= LOG_GROUP_MAX) { // bound what a power loss can take. without POWERFAIL_ADC every record.
+            log_sync();
+        }
+    }
+#endif
+    if (!(flags & LOG_REC_TEST)) {
+        sub_publish(bank, pin, val, flags, t.unixtime, id);
+    }
+    Serial.println(line); // after the commit, so that the serial port counts as a delivery
+    if (committed) {
+        metrics_delivered(id, DELIVER_SERIAL);
+    }
+}
+
+/**
+ * Queues a capture. Safe to call from both ISRs and loop(). Returns 0 if the queue is full.
+ */
+uint8_t capture_push(uint8_t bank, uint16_t intf, uint16_t intcap, uint32_t tick) {
+    uint8_t sreg = SREG;
+    cli();
+    uint8_t next = (capq_head + 1) & (CAPTURE_QUEUE_LEN - 1);
+    if (next == capq_tail) {
+        capq_drops++;
+        SREG = sreg;
+        return 0;
+    }
+    capq[capq_head].bank = bank;
+    capq[capq_head].intf = intf;
+    capq[capq_head].intcap = intcap;
+    capq[capq_head].tick = tick;
+    capq_head = next;
+    uint32_t lat = micros() - tick;
+    if (lat > capture_lat_max && !(bank & CAPTURE_SELFTEST)) { // a synthetic tick is when the event was due
+        capture_lat_max = lat;
+    }
+    SREG = sreg;
+    return 1;
+}
+
+/**
+ * Takes the oldest capture off the queue. Returns 0 if there is none.
+ */
+uint8_t capture_pop(struct Capture *c) {
+    uint8_t sreg = SREG;
+    cli();
+    if (capq_tail == capq_head) {
+        SREG = sreg;
+        return 0;
+    }
+    c->bank = capq[capq_tail].bank;
+    c->intf = capq[capq_tail].intf;
+    c->intcap = capq[capq_tail].intcap;
+    c->tick = capq[capq_tail].tick;
+    capq_tail = (capq_tail + 1) & (CAPTURE_QUEUE_LEN - 1);
+    SREG = sreg;
+    return 1;
+}
+
+#ifdef EXPANDER_SOFT_I2C
+/**
+ * Starts reading INTF and INTCAP of a bank on the expander bus. If the bus is busy the bank is remembered and
+ * read as soon as the current transaction is done. Must be called with interrupts disabled.
+ */
+void capture_start(uint8_t bank) {
+    if (expbus.startRead(MCP23017_ADDRESS | bank, MCP23017_INTFA, capture_regs, 4, capture_done) == SOFTI2C_OK) {
+        capture_bank = bank;
+    } else {
+        capture_pending |= 1 << bank;
+    }
+}
 
-    DS3231_get(&t); // receive time from RTC
-
-// Get more information from the MCP from the INT
-    uint8_t pin = mcp->getLastInterruptPin();
-    uint8_t val = mcp->getLastInterruptPinValue();
-    mcp->digitalRead(pin); // clear the interrupt condition on MCP. To speed up logging you can move this right after the line that reads uint8_t val = mcp->getLastInterruptPinValue();
-
-    uint16_t addr = (0x0080 * ((uint16_t) pin)) + (mcp->getAddr() ? 0x0800 : 0);
-    ee_h.readBlock(addr, (uint8_t*) buf_prog, 40);
-
-    sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d %40s %3s", t.year, t.mon, t.mday, t.hour, t.min, t.sec, buf_prog, val ? "ON" : "OFF");
-
-    Serial.println(buf);
-    record_data_page_write_mode(buf); // Write to eeprom
-
-//
-//    if (val0 != 0xff && val0 != val) { // lets check whether the pin has changed.
-//        DS3231_get(&t); // update the time again. it might have just taken few milliseconds yet there can be a time change in seconds.
-//
-//        sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d %40s %3s", t.year, t.mon, t.mday, t.hour, t.min, t.sec, buf_prog, val0 ? "ON" : "OFF");
-//
-//        record_data_page_write_mode(buf); // Write to eeprom
-//
-//        mcp->digitalRead(pin); // clear the interrupt condition on MCP. To speed up logging you can move this right after the line that reads val = mcp->getLastInterruptPinValue();
-//    }
-//
-//// check again if there are any interrupts pending for the same MCP chip.
-//    while ((pin = mcp->getLastInterruptPin()) != 0xff) {
-//
-//        DS3231_get(&t); //update the time
-//
-//        // there seems a valid incoming interrupt pending
-//        val = mcp->getLastInterruptPinValue();
-//
-//        addr = (0x0080 * ((uint16_t) pin)) + (mcp->getAddr() ? 0x0800 : 0);
-//        ee_h.readBlock(addr, (uint8_t*) buf_prog, 40);
-//
-//        sprintf(buf, "%04d-%02d-%02d %02d:%02d:%02d %40s %3s", t.year, t.mon, t.mday, t.hour, t.min, t.sec, buf_prog, val ? "ON" : "OFF");
-//
-//        record_data_page_write_mode(buf); // Write to eeprom
-//
-//        mcp->digitalRead(pin); // clear the interrupt condition on MCP. To speed up logging you can move this right after the line that reads val = mcp->getLastInterruptPinValue();
-//    }
-    *awakenByInterrupt = false;
-    mcp->readGPIOAB(); // make sure any pending interrupts are cleared so that MCP23017 is ready for next interrupt. must be merged with the master branch.
+/**
+ * Called from Timer2 ISR when the capture transaction is complete.
+ */
+void capture_done(uint8_t status) {
+    uint16_t intf = ((uint16_t) capture_regs[1] << 8) | capture_regs[0];
+    if (status != SOFTI2C_OK) {
+        capq_errors++;
+    } else if (intf) {
+        capture_push(capture_bank, intf, ((uint16_t) capture_regs[3] << 8) | capture_regs[2], int_tick[capture_bank]);
+    }
+    for (uint8_t bank = 0; bank < 2; bank++) {
+        if (capture_pending & (1 << bank)) {
+            capture_pending &= ~(1 << bank);
+            capture_start(bank);
+            break;
+        }
+    }
 }
+#endif
 
 ISR(PCINT2_vect) {
     uint8_t changedbits;
@@ -619,8 +1291,13 @@ ISR(PCINT2_vect) {
             // rising edge
         } else {
             // falling edge
+            int_tick[0] = micros();
+#ifdef EXPANDER_SOFT_I2C
+            capture_start(0);
+#else
             Serial.println("INT0 falling edge");
             awakenByInterrupt0 = true;
+#endif
         }
     }
 
@@ -629,8 +1306,13 @@ ISR(PCINT2_vect) {
             // rising edge
         } else {
             // falling edge]
+            int_tick[1] = micros();
+#ifdef EXPANDER_SOFT_I2C
+            capture_start(1);
+#else
             Serial.println("INT1 falling edge");
             awakenByInterrupt1 = true;
+#endif
         }
     }
 
@@ -11,15 +11,98 @@
 //add your includes for the project 101FM_data_logger here
 
 #include <inttypes.h>
+#include <util/crc16.h>
 #include "Adafruit-MCP23017-Arduino-Library/Adafruit_MCP23017.h"
 #include "ds3231/ds3231.h"
-#include "ethercard/EtherCard.h"
+#include "ethercard/EtherCard.h" // network interface, see net_enc28j60.cpp
+#define TCP_BUFF_MAX 160 // TCP buffer size reduced to save AVR SRAM for other uses
 #include "TimerOne/TimerOne.h"
+#include "SoftI2C/SoftI2C.h"
 
 #define I2C_EEPROM_PAGESIZE 128
 #include "I2C_eeprom/I2C_eeprom.h"
 
 //end of add your includes here
+
+// Board configuration
+
+#define EEPLED (1 << PD4)  // this is an on-board LED. It will also show any activity on EEPROM
+#define SYSLED (1 << PD5) // this LED is for showing the device health. It should blink ~50ms in each ~1600ms on normal operation. it is mounted on the front wall in 1U rack
+#define NETLED (1 << PD6) // this LED serves as an indicator for network activity
+
+#define INTPIN0 (1 << PD2) // interrupt pin connected to MCP23017 at 0x20
+#define INTPIN1 (1 << PD3) // interrupt pin connected to MCP23017 at 0x21
+
+// Uncomment to move both MCP23017s off the TWI bus onto a bit-banged bus on spare pins (PC0 = SDA, PC1 = SCL,
+// external pull-ups required). Interrupt captures are then read by a Timer2 paced state machine started right
+// from the pin change ISR, so capturing never waits behind EEPROM page writes on the TWI bus.
+//#define EXPANDER_SOFT_I2C
+#define EXPANDER_SDA PC0
+#define EXPANDER_SCL PC1
+
+// Uncomment for a last-gasp flush of the log when the raw supply, divided down onto this ADC channel, falls below
+// the 1.1V bandgap (see powerfail.cpp). ADC7 is an analog only pin on the TQFP package.
+//#define POWERFAIL_ADC 7
+
+#define CAPTURE_QUEUE_LEN 8 // number of pending captures. must be a power of 2
+
+// Channel table on the header 24LC512. Each channel has a 128 byte page holding its 40 character name followed by
+// the width of the channel group starting at it (see channel_groups.cpp).
+#define CHANNEL_ADDR(bank, pin) ((uint16_t) (bank) * 0x0800 + (uint16_t) (pin) * 0x0080)
+#define CHANNEL_GROUP_OFFSET 40
+#define GROUP_WIDTH_MAX 4
+#define GROUP_SETTLE_MS 20 // a group is logged once none of its pins changed for this long
+
+// Scratch area on the header 24LC512 for /selftest. The wear levelled header slots start right above it. Firmware
+// before /selftest kept header slots down to 0x1000, setup() moves a header left there up once and then clears the
+// byte at HEADER_MOVED_ADDR, a spare byte of the first channel page.
+#define SELFTEST_START 0x1000
+#define SELFTEST_END 0x2000
+#define HEADER_MOVED_ADDR (CHANNEL_ADDR(0, 0) + 0x41)
+
+// Block hashes of the data 24LC512 for /hashes, see page_hash.cpp
+#define HASH_BLOCK_SIZE 0x0400
+#define HASH_BLOCKS 64
+#define HASH_FILL_BURST 128 // bytes of the data 24LC512 a /hashes reply reads back per loop() pass
+
+#define REC_PAGES (56 - HOT_PAGES) // 64 byte pages of network chip scratch memory used by the input recorder
+
+#define CAPTURE_SELFTEST 0x80 // set in Capture.bank of synthetic captures injected by /selftest
+
+// Delivery paths of a committed event, each with its own commit to delivery histogram
+#define DELIVER_HTTP 0 // /log and /dump
+#define DELIVER_SERIAL 1 // line printed on the serial port
+#define DELIVER_PUSH 2 // line sent to a /sub client
+#define DELIVER_PATHS 3
+#define METRICS_NO_ID 0xffffffff // log position of an event which is not in the log
+
+// Log storage.
+// LOG_BACKEND_EEPROM keeps 64 byte text records on the data 24LC512 with a wear levelled header on the other one.
+// LOG_BACKEND_EEPROM_SEQ keeps 16 byte binary records on the data 24LC512 without any per event header write. The
+// head is found at boot by a binary search over the sequence numbers, the header 24LC512 only gets a checkpoint on
+// /clr. Records are staged in the network chip and written a page at a time, so it needs POWERFAIL_ADC. Do a /clr
+// after switching an existing logger to it.
+// Channel names stay on the header 24LC512 in all cases.
+#define LOG_BACKEND_EEPROM 0
+#define LOG_BACKEND_EEPROM_SEQ 1
+#define LOG_BACKEND LOG_BACKEND_EEPROM
+#if LOG_BACKEND != LOG_BACKEND_EEPROM
+#define LOG_BINARY // log keeps LogRecords
+#endif
+#if LOG_BACKEND == LOG_BACKEND_EEPROM_SEQ
+#ifndef POWERFAIL_ADC
+#error LOG_BACKEND_EEPROM_SEQ holds records in the network chip for up to 10s. Only the POWERFAIL_ADC last gasp saves them.
+#endif
+#define HOT_PAGES 5 // 64 byte pages of network chip scratch memory after REC_PAGES: 4 of records not yet on the
+                    // 24LC512, 1 of their capture ticks
+#else
+#define HOT_PAGES 0
+#endif
+#ifdef POWERFAIL_ADC
+#define LOG_GROUP_MAX 8 // LOG_BACKEND_EEPROM writes the header at least once per this many records
+#else
+#define LOG_GROUP_MAX 1 // without the last gasp a record is only acknowledged once the header is written
+#endif
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +114,25 @@ void setup();
 
 //add your function definitions for the project 101FM_data_logger here
 
+extern I2C_eeprom ee_h;
+extern I2C_eeprom ee_d;
+extern volatile uint16_t dh_addr;
+extern volatile uint32_t int_tick[2];
+extern volatile uint16_t capq_errors;
+extern Adafruit_MCP23017 mcp0, mcp1;
+extern struct ts t;
+extern struct LatencyHist lat_commit, lat_deliver[DELIVER_PATHS];
+extern uint16_t lat_untracked;
+extern struct BusTime bus_capture, bus_name;
+extern struct LoopStall loop_stall;
+#if LOG_BACKEND == LOG_BACKEND_EEPROM_SEQ
+extern uint32_t tier_writes, tier_records;
+uint8_t binlog_hot();
+#endif
+#ifdef EXPANDER_SOFT_I2C
+extern SoftI2C expbus;
+#endif
+
 struct DataHeader {
 	uint16_t a; // address location of latest block of log
 	uint16_t b; // address location of earliest block of log
@@ -38,8 +140,117 @@ struct DataHeader {
 				// that we use the inverse of unixtime. 24LC512 (and may be many other chips) comes all their
 				// data bytes written as 0xff. Therefore we should pick a value that is being decremented over time.
 };
+struct Capture {
+	uint8_t bank; // 0 for MCP23017 at 0x20, 1 for 0x21. CAPTURE_SELFTEST may be set
+	uint16_t intf; // INTFB:INTFA. pins those caused the interrupt
+	uint16_t intcap; // INTCAPB:INTCAPA. port values latched at the time of the interrupt
+	uint32_t tick; // micros() when the INT line fell
+};
+
+#define LOG_REC_CLEAR 0x01 // record is a /clr marker. everything up to and including it is cleared
+#define LOG_REC_GROUP 0x02 // pin is the first pin of a channel group and val its decoded value
+#define LOG_REC_TEST 0x04 // synthetic /selftest event. never reaches the log
+#define LOG_REC_POWER 0x08 // power-fail marker. val is the number of captures lost
+
+// Binary log record. seq and crc make every record self describing so that no separate header is needed.
+struct LogRecord {
+	uint32_t seq; // sequence number. also tells the position of the record in the ring
+	uint32_t time; // unix time of the event
+	uint8_t bank;
+	uint8_t pin;
+	uint8_t val; // 0 or 1, or the decoded value of a group
+	uint8_t flags; // LOG_REC_*
+	uint16_t spare; // sequence numbers back to the previous record of the channel. see chain.cpp
+	uint16_t crc; // CRC16 of all the bytes above
+};
+
+#define LAT_BUCKETS 12 // buckets per latency histogram
+
+// Latency histogram, see metrics.cpp
+struct LatencyHist {
+	uint16_t count[LAT_BUCKETS]; // bucket n counts values below 2^n units. saturates at 0xffff
+	uint32_t max; // worst value seen
+	uint32_t max_id; // log position of the event with the worst value
+};
+
+// Time spent on the I2C bus by one kind of transaction, see metrics.cpp
+struct BusTime {
+	uint16_t count; // transactions timed. saturates at 0xffff
+	uint32_t sum; // μs
+	uint32_t max; // μs
+};
+
+#define STALL_CAUSE_LEN 24 // characters of the request kept with the longest loop() pass
+#define STALL_MIN_US 10000 // shorter loop() passes are not marked in the input recorder
+
+// Longest loop() pass so far, see metrics.cpp
+struct LoopStall {
+	uint32_t max; // μs
+	uint16_t drops; // captures dropped during that pass
+	char cause[STALL_CAUSE_LEN + 1]; // start of the request handled in that pass, "-" if there was none
+};
+
+// Position while walking the log from newest to oldest.
+struct LogCursor {
+	uint32_t pos; // one past the next record to read
+	uint32_t end; // oldest position. reading stops here
+	uint32_t epoch; // LOG_BACKEND_EEPROM: record count at which the writer starts overwriting end
+#ifdef LOG_BINARY
+	uint8_t bank; // channel whose chain is followed, 0xff for every record
+	uint8_t pin;
+	uint8_t scan; // looking for the next record of the channel record by record
+#endif
+};
+
+#define LOG_STREAM_BURST 4 // lines of a /log or /dump reply sent per loop() pass
+#define REC_STREAM_BURST 8 // entries of a /rec reply sent per loop() pass
+#define CHAIN_SCAN_MAX 1024 // records scanned at boot for the newest record of each channel, see chain.cpp
+#define CHAIN_SCAN_BURST 64 // records a /log?ch= reply scans per line where a chain has no link
+
+// Live subscriptions, see subscribe.cpp
+#define SUB_MAX 2 // concurrent /sub clients
+#define SUB_QUEUE_LEN 8 // events waiting per subscriber
+#define SUB_BURST 4 // lines sent per subscriber per loop() pass
+
+// /hashes reply waiting for its block hashes to be read back
+struct HashReply {
+	uint8_t active;
+	uint8_t from;
+	uint8_t to;
+	uint8_t reply[HTTP_REPLY_STATE_LEN]; // see HttpReply::save()
+};
+
+// /log or /dump reply in progress
+struct LogStream {
+	uint8_t active;
+	uint16_t left; // lines still to send. 0 for all
+	struct LogCursor cur;
+	uint8_t reply[HTTP_REPLY_STATE_LEN]; // see HttpReply::save()
+};
+
+// /rec reply in progress
+struct RecStream {
+	uint8_t active;
+	uint16_t first; // slot of the oldest entry when the reply started
+	uint16_t n; // entries sent
+	uint16_t count; // entries to send
+	uint8_t reply[HTTP_REPLY_STATE_LEN]; // see HttpReply::save()
+};
+
 void responseLog(char *data);
+void responseStatus(PGM_P header, PGM_P body);
+void responseStream(uint16_t lines, uint8_t bank, uint8_t pin);
+void log_stream_poll();
+void responseSubscribe(const char *filter);
+uint8_t sub_filter_valid(const char *filter);
+void sub_open(const char *filter, const uint8_t *reply);
+void sub_publish(uint8_t bank, uint8_t pin, uint8_t val, uint8_t flags, uint32_t time, uint32_t id);
+void sub_poll();
 void responseChannels();
+void responseMetrics();
+void responseRecorder();
+void rec_stream_poll();
+void responseSelftest();
 void toggleSYS();
 void toggleNET();
 void beatSYS();
@@ -54,6 +265,80 @@ uint8_t record_data_page_write_mode(unsigned char* data);
 
 void handleInterrupt(Adafruit_MCP23017 *mcp,
 		volatile boolean *awakenByInterrupt);
+void handleCapture(struct Capture *c);
+void record_event(uint8_t bank, uint8_t pin, uint8_t val, uint8_t flags, uint32_t tick);
+uint8_t log_open(struct LogCursor *c);
+uint8_t log_prev(struct LogCursor *c, char *line);
+void log_clear();
+void log_power_fail(uint8_t lost);
+#ifndef LOG_BINARY
+void log_sync();
+#endif
+uint16_t log_record_crc(const struct LogRecord *r);
+void format_record(const struct LogRecord *r, char *line);
+void format_value(uint8_t val, uint8_t flags, char *str);
+void unixtime_to_ts(uint32_t unixtime, struct ts *tm);
+#ifdef LOG_BINARY
+uint8_t binlog_begin();
+void binlog_poll();
+void binlog_flush();
+uint8_t binlog_append(struct LogRecord *r, uint32_t tick);
+uint8_t binlog_read(uint32_t seq, struct LogRecord *r);
+void binlog_clear(uint32_t time);
+uint32_t binlog_head();
+uint32_t binlog_tail();
+void chain_begin();
+uint16_t chain_link(const struct LogRecord *r);
+uint8_t chain_open(struct LogCursor *c, uint8_t bank, uint8_t pin);
+uint8_t chain_prev(struct LogCursor *c, char *line);
+#endif
+void metrics_commit(uint32_t id, uint32_t tick);
+void metrics_delivered(uint32_t id, uint8_t path);
+uint8_t hist_format(const struct LatencyHist *h, const char *name, char *line);
+void bus_time(struct BusTime *b, uint32_t since);
+void loop_time(uint32_t since, uint16_t drops, const char *cause);
+void loop_stall_reset();
+uint8_t net_begin(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw);
+char *net_request();
+uint8_t net_closed(const uint8_t *reply);
+void net_scratch_write(uint8_t page, uint8_t off, const uint8_t *data, uint8_t len);
+uint8_t net_scratch_read(uint8_t page, uint8_t off);
+uint8_t selftest_start(uint16_t rate, uint16_t count, char pattern);
+void selftest_poll();
+void selftest_commit(const uint8_t *data, uint8_t len, uint32_t tick);
+uint8_t selftest_report(uint8_t n, char *line);
+void hash_written(uint16_t addr, const uint8_t *data, uint8_t len);
+void hash_invalidate(uint16_t addr);
+uint16_t hash_block(uint8_t block);
+uint16_t hash_range(uint8_t from, uint8_t to);
+uint8_t hash_fill(uint8_t from, uint8_t to);
+uint8_t parse_block(const char *s);
+void responseHashes(uint8_t from, uint8_t to);
+void hashes_poll();
+void responseBlock(uint8_t block);
+#ifdef POWERFAIL_ADC
+extern volatile uint8_t powerfail_pending;
+void powerfail_begin();
+void powerfail_poll();
+#endif
+void recorder_enable(uint8_t on);
+void recorder_capture(const struct Capture *c);
+void recorder_frame(uint8_t proto, uint16_t len, uint16_t type, uint16_t port, uint8_t flags);
+void recorder_stall(uint32_t us, uint16_t drops);
+void rtc_get(struct ts *tm);
+uint16_t recorder_count();
+uint16_t recorder_oldest();
+void recorder_format(uint16_t first, uint16_t n, char *line);
+void group_begin();
+uint8_t group_set(uint8_t bank, uint8_t pin, uint8_t width);
+uint16_t group_capture(struct Capture *c);
+void group_poll();
+uint8_t capture_push(uint8_t bank, uint16_t intf, uint16_t intcap, uint32_t tick);
+uint8_t capture_pop(struct Capture *c);
+#ifdef EXPANDER_SOFT_I2C
+void capture_start(uint8_t bank);
+void capture_done(uint8_t status);
+#endif
 //void cleanInterrupts(volatile boolean  *awakenByInterrupt);
 
 //Do not add code below this line
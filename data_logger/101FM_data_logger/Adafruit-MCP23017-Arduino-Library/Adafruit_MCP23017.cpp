@@ -16,6 +16,7 @@
 #include <avr/pgmspace.h>
 #endif
 #include "Adafruit_MCP23017.h"
+#include "../SoftI2C/SoftI2C.h"
 
 #if ARDUINO >= 100
 #include "Arduino.h"
@@ -58,12 +59,24 @@ uint8_t Adafruit_MCP23017::regForPin(uint8_t pin, uint8_t portAaddr, uint8_t por
  * Reads a given register
  */
 uint8_t Adafruit_MCP23017::readRegister(uint8_t addr){
-	// read the current GPINTEN
-	Wire.beginTransmission(MCP23017_ADDRESS | i2caddr);
-	wiresend(addr);
-	Wire.endTransmission();
-	Wire.requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-	return wirerecv();
+	uint8_t value;
+	readRegisters(addr, &value, 1);
+	return value;
+}
+
+/**
+ * Reads len consecutive registers starting at addr (IOCON.SEQOP is left at its default, sequential). Returns 0 if
+ * the chip did not answer or the transfer failed, data is not to be trusted then.
+ */
+uint8_t Adafruit_MCP23017::readRegisters(uint8_t addr, uint8_t *data, uint8_t len){
+	if (bus) {
+		return bus->readBytes(MCP23017_ADDRESS | i2caddr, addr, data, len) == SOFTI2C_OK;
+	}
+	if (Wire.requestFrom(MCP23017_ADDRESS | i2caddr, len, addr, 1) != len)	// register address, repeated start, data
+		return 0;
+	for (uint8_t i = 0; i < len; i++)
+		data[i] = wirerecv();
+	return 1;
 }
 
 
@@ -71,6 +84,11 @@ uint8_t Adafruit_MCP23017::readRegister(uint8_t addr){
  * Writes a given register
  */
 void Adafruit_MCP23017::writeRegister(uint8_t regAddr, uint8_t regValue){
+	if (bus) {
+		uint8_t tx[2] = { regAddr, regValue };
+		bus->writeBytes(MCP23017_ADDRESS | i2caddr, tx, 2);
+		return;
+	}
 	// Write the register
 	Wire.beginTransmission(MCP23017_ADDRESS | i2caddr);
 	wiresend(regAddr);
@@ -102,12 +120,24 @@ void Adafruit_MCP23017::updateRegisterBit(uint8_t pin, uint8_t pValue, uint8_t p
  * Initializes the MCP23017 given its HW selected address, see datasheet for Address selection.
  */
 void Adafruit_MCP23017::begin(uint8_t addr) {
+	begin(addr, 0);
+}
+
+/**
+ * Same as begin(addr) but the chip is reached through a bit-banged bus instead of Wire when b is not NULL.
+ */
+void Adafruit_MCP23017::begin(uint8_t addr, SoftI2C *b) {
 	if (addr > 7) {
 		addr = 7;
 	}
 	i2caddr = addr;
+	bus = b;
 
-	Wire.begin();
+	if (bus) {
+		bus->begin();
+	} else {
+		Wire.begin();
+	}
 
 	// set defaults!
 	// all inputs on port A and B
@@ -140,21 +170,12 @@ void Adafruit_MCP23017::pinMode(uint8_t p, uint8_t d) {
  * Reads all 16 pins (port A and B) into a single 16 bits variable.
  */
 uint16_t Adafruit_MCP23017::readGPIOAB() {
-	uint16_t ba = 0;
-	uint8_t a;
+	uint8_t ab[2];
 
 	// read the current GPIO output latches
-	Wire.beginTransmission(MCP23017_ADDRESS | i2caddr);
-	wiresend(MCP23017_GPIOA);
-	Wire.endTransmission();
-
-	Wire.requestFrom(MCP23017_ADDRESS | i2caddr, 2);
-	a = wirerecv();
-	ba = wirerecv();
-	ba <<= 8;
-	ba |= a;
+	readRegisters(MCP23017_GPIOA, ab, 2);
 
-	return ba;
+	return ((uint16_t) ab[1] << 8) | ab[0];
 }
 
 /**
@@ -164,22 +185,18 @@ uint16_t Adafruit_MCP23017::readGPIOAB() {
 uint8_t Adafruit_MCP23017::readGPIO(uint8_t b) {
 
 	// read the current GPIO output latches
-	Wire.beginTransmission(MCP23017_ADDRESS | i2caddr);
-	if (b == 0)
-		wiresend(MCP23017_GPIOA);
-	else {
-		wiresend(MCP23017_GPIOB);
-	}
-	Wire.endTransmission();
-
-	Wire.requestFrom(MCP23017_ADDRESS | i2caddr, 1);
-	return wirerecv();
+	return readRegister(b == 0 ? MCP23017_GPIOA : MCP23017_GPIOB);
 }
 
 /**
  * Writes all the pins in one go. This method is very useful if you are implementing a multiplexed matrix and want to get a decent refresh rate.
  */
 void Adafruit_MCP23017::writeGPIOAB(uint16_t ba) {
+	if (bus) {
+		uint8_t tx[3] = { MCP23017_GPIOA, (uint8_t) (ba & 0xFF), (uint8_t) (ba >> 8) };
+		bus->writeBytes(MCP23017_ADDRESS | i2caddr, tx, 3);
+		return;
+	}
 	Wire.beginTransmission(MCP23017_ADDRESS | i2caddr);
 	wiresend(MCP23017_GPIOA);
 	wiresend(ba & 0xFF);
@@ -293,4 +310,38 @@ uint8_t Adafruit_MCP23017::getLastInterruptPinValue(){
 	return MCP23017_INT_ERR;
 }
 
+/**
+ * Reads INTFA, INTFB, INTCAPA and INTCAPB in one sequential transaction. Reading INTCAP clears the interrupt
+ * condition on both ports, so the chip is ready for the next change as soon as this returns.
+ * Returns 0 if the read failed, with intf and intcap cleared. A chip that does not answer must not read as 0xFFFF.
+ */
+uint8_t Adafruit_MCP23017::readInterruptCapture(uint16_t *intf, uint16_t *intcap){
+	uint8_t regs[4];
+	if (!readRegisters(MCP23017_INTFA, regs, 4)) {
+		*intf = 0;
+		*intcap = 0;
+		return 0;
+	}
+	*intf = ((uint16_t) regs[1] << 8) | regs[0];
+	*intcap = ((uint16_t) regs[3] << 8) | regs[2];
+	return 1;
+}
 
+/**
+ * Reads INTF, INTCAP and GPIO of both ports in one sequential transaction (INTFA to GPIOB are adjacent). Use it
+ * instead of readGPIOAB() where an interrupt must not be lost: reading GPIO clears a pending interrupt, but here it
+ * comes back in intf and intcap. Returns 0 if the read failed, with all three cleared.
+ */
+uint8_t Adafruit_MCP23017::readInterruptState(uint16_t *intf, uint16_t *intcap, uint16_t *gpio){
+	uint8_t regs[6];
+	if (!readRegisters(MCP23017_INTFA, regs, 6)) {
+		*intf = 0;
+		*intcap = 0;
+		*gpio = 0;
+		return 0;
+	}
+	*intf = ((uint16_t) regs[1] << 8) | regs[0];
+	*intcap = ((uint16_t) regs[3] << 8) | regs[2];
+	*gpio = ((uint16_t) regs[5] << 8) | regs[4];
+	return 1;
+}
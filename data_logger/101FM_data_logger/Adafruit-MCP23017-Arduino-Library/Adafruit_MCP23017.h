@@ -14,10 +14,13 @@
 #ifndef _Adafruit_MCP23017_H_
 #define _Adafruit_MCP23017_H_
 
+class SoftI2C;
+
 // Don't forget the Wire library
 class Adafruit_MCP23017 {
 public:
   void begin(uint8_t addr);
+  void begin(uint8_t addr, SoftI2C *bus);
   uint8_t getAddr();
   void begin(void);
 
@@ -35,14 +38,18 @@ public:
   void setupInterruptPin(uint8_t p, uint8_t mode);
   uint8_t getLastInterruptPin();
   uint8_t getLastInterruptPinValue();
+  uint8_t readInterruptCapture(uint16_t *intf, uint16_t *intcap);
+  uint8_t readInterruptState(uint16_t *intf, uint16_t *intcap, uint16_t *gpio);
 
  private:
   uint8_t i2caddr;
+  SoftI2C *bus;
 
   uint8_t bitForPin(uint8_t pin);
   uint8_t regForPin(uint8_t pin, uint8_t portAaddr, uint8_t portBaddr);
 
   uint8_t readRegister(uint8_t addr);
+  uint8_t readRegisters(uint8_t addr, uint8_t *data, uint8_t len);
   void writeRegister(uint8_t addr, uint8_t value);
 
   /**
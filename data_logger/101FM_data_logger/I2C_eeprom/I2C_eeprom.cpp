@@ -127,7 +127,8 @@ int I2C_eeprom::_pageBlock(uint16_t address, uint8_t* buffer, uint16_t length, b
     while (length > 0) {
         uint8_t bytesUntilPageBoundary = I2C_EEPROM_PAGESIZE - address % I2C_EEPROM_PAGESIZE;
         uint8_t cnt = min(length, bytesUntilPageBoundary);
-        cnt = min(cnt, I2C_TWIBUFFERSIZE);
+        if (!incrBuffer)  // setBlock() repeats a buffer of I2C_TWIBUFFERSIZE
+            cnt = min(cnt, I2C_TWIBUFFERSIZE);
 
         int rv = _WriteBlock(address, buffer, cnt); // todo check return value..
         if (rv != 0)
@@ -141,24 +142,13 @@ int I2C_eeprom::_pageBlock(uint16_t address, uint8_t* buffer, uint16_t length, b
     return rv;
 }
 
-// pre: length <= I2C_EEPROM_PAGESIZE  && length <= I2C_TWIBUFFERSIZE;
+// pre: length <= I2C_EEPROM_PAGESIZE and within one page
 // returns 0 = OK otherwise error
 int I2C_eeprom::_WriteBlock(uint16_t address, uint8_t* buffer, uint8_t length) {
     waitEEReady();
 
-    Wire.beginTransmission(_deviceAddress);
-#if defined(ARDUINO) && ARDUINO >= 100
-    Wire.write((int) (address >> 8));
-    Wire.write((int) (address & 0xFF));
-    for (uint8_t cnt = 0; cnt < length; cnt++)
-        Wire.write(buffer[cnt]);
-#else
-    Wire.send((int)(address >> 8));
-    Wire.send((int)(address & 0xFF));
-    for (uint8_t cnt = 0; cnt < length; cnt++)
-    Wire.send(buffer[cnt]);
-#endif
-    int rv = Wire.endTransmission();
+    // memory address then data straight from buffer. a whole page is one write cycle.
+    int rv = Wire.writeTo(_deviceAddress, address, 2, buffer, length);
     _lastWrite = micros();
     return rv;
 }
@@ -168,19 +158,9 @@ int I2C_eeprom::_WriteBlock(uint16_t address, uint8_t* buffer, uint8_t length) {
 uint8_t I2C_eeprom::_ReadBlock(uint16_t address, uint8_t* buffer, uint8_t length) {
     waitEEReady();
 
-    Wire.beginTransmission(_deviceAddress);
-#if defined(ARDUINO) && ARDUINO >= 100
-    Wire.write((int) (address >> 8));
-    Wire.write((int) (address & 0xFF));
-#else
-    Wire.send((int)(address >> 8));
-    Wire.send((int)(address & 0xFF));
-#endif
-    int rv = Wire.endTransmission();
-    if (rv != 0)
+    // memory address, repeated start, data. the 24LC512 random read.
+    if (Wire.requestFrom(_deviceAddress, length, address, 2) == 0)
         return 0;  // error
-
-    Wire.requestFrom(_deviceAddress, length);
     uint8_t cnt = 0;
     uint32_t before = millis();
     while ((cnt < length) && ((millis() - before) < I2C_EEPROM_TIMEOUT)) {
@@ -195,17 +175,11 @@ uint8_t I2C_eeprom::_ReadBlock(uint16_t address, uint8_t* buffer, uint8_t length
 }
 
 void I2C_eeprom::waitEEReady() {
-    // Wait until EEPROM gives ACK again.
-    // this is a bit faster than the hardcoded 5 milli
-//    Serial.println(micros(), 10);
-    _delay_us(I2C_WRITEDELAY);
-//    while ((micros() - _lastWrite) <= I2C_WRITEDELAY) {
-//        Wire.beginTransmission(_deviceAddress);
-//        int x = Wire.endTransmission();
-//        if (x == 0){
-//            break;
-//        }
-//    }
+    // Wait out what is left of the write cycle started by the last write, if any. A transfer after a pause goes
+    // straight ahead. delayMicroseconds() also works with interrupts off.
+    uint32_t since = micros() - _lastWrite;
+    if (since < I2C_WRITEDELAY)
+        delayMicroseconds(I2C_WRITEDELAY - since);
 }
 
 //
@@ -53,6 +53,8 @@ public:
     uint8_t readByte(uint16_t address);
     uint16_t readBlock(uint16_t address, uint8_t* buffer, uint16_t length);
 
+    void waitEEReady();
+
 #ifdef I2C_EEPROM_EXTENDED
     uint8_t determineSize();
 #endif
@@ -64,8 +66,6 @@ private:
     int _pageBlock(uint16_t address, uint8_t* buffer, uint16_t length, bool incrBuffer);
     int _WriteBlock(uint16_t address, uint8_t* buffer, uint8_t length);
     uint8_t _ReadBlock(uint16_t address, uint8_t* buffer, uint8_t length);
-
-    void waitEEReady();
 };
 
 #endif
@@ -0,0 +1,296 @@
+/*
+ * SoftI2C.cpp - bit-banged I²C master for AVR
+ *
+ * See SoftI2C.h for the wiring requirements.
+ */
+
+#include "Arduino.h"
+#include <avr/interrupt.h>
+#include <util/delay.h>
+#include "SoftI2C.h"
+
+// states of the transaction state machine. Each state takes one or more ticks (half clock periods).
+#define S_IDLE 0
+#define S_START 1
+#define S_TX 2
+#define S_TX_ACK 3
+#define S_RSTART 4
+#define S_RX 5
+#define S_RX_ACK 6
+#define S_STOP 7
+
+SoftI2C *SoftI2C::async = 0;
+
+SoftI2C::SoftI2C(volatile uint8_t *port, volatile uint8_t *ddr, volatile uint8_t *pin, uint8_t sdaBit, uint8_t sclBit) {
+    _port = port;
+    _ddr = ddr;
+    _pin = pin;
+    _sda = 1 << sdaBit;
+    _scl = 1 << sclBit;
+    _state = S_IDLE;
+    transactions = 0;
+    errors = 0;
+}
+
+/**
+ * Releases both lines. PORT bits are kept at 0 so that setting a DDR bit pulls the line low.
+ */
+void SoftI2C::begin() {
+    *_ddr &= ~(_sda | _scl);
+    *_port &= ~(_sda | _scl);
+}
+
+/**
+ * Writes len bytes (register address followed by data) to the slave at addr. Returns SOFTI2C_TOO_LONG without
+ * touching the bus if len exceeds SOFTI2C_TX_MAX.
+ */
+uint8_t SoftI2C::writeBytes(uint8_t addr, const uint8_t *data, uint8_t len) {
+    if (len > SOFTI2C_TX_MAX) {
+        return SOFTI2C_TOO_LONG;
+    }
+    while (!claim())
+        ;
+    prepare(addr, data, len, 0, 0);
+    return run();
+}
+
+/**
+ * Writes reg to the slave at addr and reads back len bytes after a repeated start.
+ */
+uint8_t SoftI2C::readBytes(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len) {
+    while (!claim())
+        ;
+    prepare(addr, &reg, 1, data, len);
+    return run();
+}
+
+/**
+ * Same as readBytes() but returns immediately. Timer2 paces the transaction and done is called from its ISR.
+ */
+uint8_t SoftI2C::startRead(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len, void (*done)(uint8_t)) {
+    if (!claim()) {
+        return SOFTI2C_BUSY;
+    }
+    prepare(addr, &reg, 1, data, len);
+    _done = done;
+    async = this;
+
+    TCCR2A = (1 << WGM21);	// CTC mode
+    OCR2A = (F_CPU / 8 / 1000000UL) * SOFTI2C_HALF_BIT_US - 1;
+    TCNT2 = 0;
+    TCCR2B = (1 << CS21);	// prescaler 8
+    TIMSK2 |= (1 << OCIE2A);
+    return SOFTI2C_OK;
+}
+
+bool SoftI2C::claim() {
+    uint8_t sreg = SREG;
+    cli();
+    bool ok = (_state == S_IDLE);
+    if (ok) {
+        _state = S_START;
+    }
+    SREG = sreg;
+    return ok;
+}
+
+void SoftI2C::prepare(uint8_t addr, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen) {
+    if (txLen > SOFTI2C_TX_MAX) {
+        txLen = SOFTI2C_TX_MAX;
+    }
+    for (uint8_t i = 0; i < txLen; i++) {
+        _tx[i] = tx[i];
+    }
+    _addr = addr;
+    _txLen = txLen;
+    _txIdx = 0;
+    _rx = rx;
+    _rxLen = rxLen;
+    _rxIdx = 0;
+    _status = SOFTI2C_OK;
+    _phase = 0;
+    _stretch = 0;
+    _reading = 0;
+    _isAddr = 1;
+    _byte = addr << 1;
+    _bit = 8;
+    _done = 0;
+}
+
+/**
+ * Ticks the state machine with busy waits. Used by the blocking calls.
+ */
+uint8_t SoftI2C::run() {
+    while (_state != S_IDLE) {
+        tick();
+        _delay_us(SOFTI2C_HALF_BIT_US);
+    }
+    return _status;
+}
+
+/**
+ * Releases SCL and checks whether it really went high. A slave may hold it low (clock stretching),
+ * in which case we retry on the next tick until SOFTI2C_STRETCH_MAX.
+ */
+bool SoftI2C::clockHigh() {
+    if (sclRelease()) {
+        _stretch = 0;
+        return true;
+    }
+    if (++_stretch > SOFTI2C_STRETCH_MAX) {
+        _status = SOFTI2C_TIMEOUT;
+        _state = S_STOP;
+        _phase = 0;
+    }
+    return false;
+}
+
+/**
+ * Decides what follows an acknowledged byte.
+ */
+void SoftI2C::nextByte() {
+    _isAddr = 0;
+    if (_reading) {	// read address was acknowledged. slave starts sending.
+        _byte = 0;
+        _bit = 8;
+        _state = S_RX;
+    } else if (_txIdx < _txLen) {
+        _byte = _tx[_txIdx++];
+        _bit = 8;
+        _state = S_TX;
+    } else if (_rxLen) {
+        _state = S_RSTART;
+    } else {
+        _state = S_STOP;
+    }
+}
+
+void SoftI2C::finish() {
+    transactions++;
+    if (_status != SOFTI2C_OK) {
+        errors++;
+    }
+    void (*done)(uint8_t) = _done;
+    if (async == this) {
+        TIMSK2 &= ~(1 << OCIE2A);
+        TCCR2B = 0;
+        async = 0;
+    }
+    _state = S_IDLE;
+    if (done) {
+        done(_status);	// done may start the next asynchronous transaction
+    }
+}
+
+void SoftI2C::tick() {
+    switch (_state) {
+    case S_START: // SDA falls while SCL is high
+        sdaLow();
+        _state = S_TX;
+        break;
+    case S_TX:
+        if (!_phase) {
+            sclLow();
+            if (_byte & 0x80) {
+                sdaRelease();
+            } else {
+                sdaLow();
+            }
+            _byte <<= 1;
+            _phase = 1;
+        } else if (clockHigh()) {
+            _phase = 0;
+            if (!--_bit) {
+                _state = S_TX_ACK;
+            }
+        }
+        break;
+    case S_TX_ACK:
+        if (!_phase) {
+            sclLow();
+            sdaRelease();
+            _phase = 1;
+        } else if (clockHigh()) {
+            _phase = 0;
+            if (sdaRead()) {	// NACK
+                _status = _isAddr ? SOFTI2C_NACK_ADDR : SOFTI2C_NACK_DATA;
+                _state = S_STOP;
+            } else {
+                nextByte();
+            }
+        }
+        break;
+    case S_RSTART:
+        if (_phase == 0) {
+            sclLow();
+            sdaRelease();
+            _phase = 1;
+        } else if (_phase == 1) {
+            if (clockHigh()) {
+                _phase = 2;
+            }
+        } else { // SDA falls while SCL is high
+            sdaLow();
+            _byte = (_addr << 1) | 1;
+            _bit = 8;
+            _reading = 1;
+            _isAddr = 1;
+            _phase = 0;
+            _state = S_TX;
+        }
+        break;
+    case S_RX:
+        if (!_phase) {
+            sclLow();
+            sdaRelease();
+            _phase = 1;
+        } else if (clockHigh()) {
+            _byte = (_byte << 1) | (sdaRead() ? 1 : 0);
+            _phase = 0;
+            if (!--_bit) {
+                _state = S_RX_ACK;
+            }
+        }
+        break;
+    case S_RX_ACK:
+        if (!_phase) {
+            sclLow();
+            _rx[_rxIdx++] = _byte;
+            if (_rxIdx < _rxLen) {
+                sdaLow();	// ACK. we want more
+            } else {
+                sdaRelease();	// NACK on the last byte
+            }
+            _phase = 1;
+        } else if (clockHigh()) {
+            _phase = 0;
+            if (_rxIdx < _rxLen) {
+                _byte = 0;
+                _bit = 8;
+                _state = S_RX;
+            } else {
+                _state = S_STOP;
+            }
+        }
+        break;
+    case S_STOP:
+        if (_phase == 0) {
+            sclLow();
+            sdaLow();
+            _phase = 1;
+        } else if (_phase == 1) {
+            sclRelease();	// no stretch check here. a stuck bus must not keep us in STOP forever
+            _phase = 2;
+        } else { // SDA rises while SCL is high
+            sdaRelease();
+            finish();
+        }
+        break;
+    }
+}
+
+ISR(TIMER2_COMPA_vect) {
+    if (SoftI2C::async) {
+        SoftI2C::async->tick();
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * SoftI2C.h - bit-banged I²C master for AVR
+ *
+ * A second I²C master on any two spare GPIO pins of the same port. Lines are driven open-drain by switching
+ * the DDR bit (PORT bit kept at 0), so external pull-ups (~4.7kΩ) are required on both SDA and SCL.
+ *
+ * Transactions run as a state machine which advances one half clock period per tick(). Blocking calls tick
+ * the machine themselves, while asynchronous calls are paced by Timer2 in CTC mode so that the caller (even
+ * an ISR) returns immediately and a completion callback is fired from the Timer2 ISR. Timer2 only runs while
+ * an asynchronous transaction is in flight.
+ *
+ * Only one SoftI2C instance may use the asynchronous mode since Timer2 is shared.
+ */
+
+#ifndef SoftI2C_h
+#define SoftI2C_h
+
+#include <inttypes.h>
+
+#define SOFTI2C_HALF_BIT_US 10	// 10μs per half period which results in ~50kHz SCL
+#define SOFTI2C_STRETCH_MAX 100	// max ticks to wait on a slave holding SCL low before giving up
+#define SOFTI2C_TX_MAX 4	// max bytes written before a (repeated) start for reading
+
+// status codes. 0 - 4 follow the same meaning as Wire.endTransmission()
+#define SOFTI2C_OK 0
+#define SOFTI2C_TOO_LONG 1
+#define SOFTI2C_NACK_ADDR 2
+#define SOFTI2C_NACK_DATA 3
+#define SOFTI2C_TIMEOUT 4
+#define SOFTI2C_BUSY 5
+
+class SoftI2C {
+public:
+    SoftI2C(volatile uint8_t *port, volatile uint8_t *ddr, volatile uint8_t *pin, uint8_t sdaBit, uint8_t sclBit);
+
+    void begin();
+
+    // blocking transfers. They wait for an asynchronous transaction in flight to finish first.
+    uint8_t writeBytes(uint8_t addr, const uint8_t *data, uint8_t len);
+    uint8_t readBytes(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len);
+
+    // asynchronous transfer. Writes reg then reads len bytes with a repeated start. Returns SOFTI2C_BUSY if
+    // another transaction is in flight, otherwise SOFTI2C_OK and done(status) is called from Timer2 ISR.
+    uint8_t startRead(uint8_t addr, uint8_t reg, uint8_t *data, uint8_t len, void (*done)(uint8_t));
+
+    bool busy() { return _state != 0; }
+
+    void tick();	// advances the state machine by one half clock period
+
+    volatile uint16_t transactions;	// completed transactions
+    volatile uint16_t errors;	// transactions ended with NACK or timeout
+
+    static SoftI2C *async;	// instance currently driven by Timer2
+
+private:
+    volatile uint8_t *_port;
+    volatile uint8_t *_ddr;
+    volatile uint8_t *_pin;
+    uint8_t _sda;
+    uint8_t _scl;
+
+    volatile uint8_t _state;
+    uint8_t _phase;
+    uint8_t _bit;
+    uint8_t _byte;
+    uint8_t _stretch;
+    uint8_t _status;
+    uint8_t _addr;
+    uint8_t _reading;
+    uint8_t _isAddr;
+    uint8_t _tx[SOFTI2C_TX_MAX];
+    uint8_t _txLen;
+    uint8_t _txIdx;
+    uint8_t *_rx;
+    uint8_t _rxLen;
+    uint8_t _rxIdx;
+    void (*_done)(uint8_t);
+
+    bool claim();
+    void prepare(uint8_t addr, const uint8_t *tx, uint8_t txLen, uint8_t *rx, uint8_t rxLen);
+    uint8_t run();
+    void nextByte();
+    bool clockHigh();
+    void finish();
+
+    void sdaLow() { *_ddr |= _sda; }
+    void sdaRelease() { *_ddr &= ~_sda; }
+    void sclLow() { *_ddr |= _scl; }
+    bool sclRelease() { *_ddr &= ~_scl; return *_pin & _scl; }
+    bool sdaRead() { return *_pin & _sda; }
+};
+
+#endif
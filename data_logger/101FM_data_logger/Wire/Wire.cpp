@@ -95,6 +95,52 @@ uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop
   return read;
 }
 
+// Writes the isize bytes of iaddress (register or memory address, most
+// significant byte first) and reads quantity bytes after a repeated start,
+// as a single transaction. Cheaper than endTransmission(false) followed by
+// requestFrom() as the turn around is done by the TWI ISR.
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint32_t iaddress, uint8_t isize)
+{
+  uint8_t ibuf[4];
+  if(quantity > BUFFER_LENGTH){
+    quantity = BUFFER_LENGTH;
+  }
+  if(isize > sizeof ibuf){
+    isize = sizeof ibuf;
+  }
+  for(uint8_t i = 0; i < isize; i++){
+    ibuf[i] = iaddress >> (8 * (isize - 1 - i));
+  }
+  uint8_t read = twi_writeRead(address, ibuf, isize, rxBuffer, quantity);
+  rxBufferIndex = 0;
+  rxBufferLength = read;
+
+  return read;
+}
+
+// Writes the isize bytes of iaddress (most significant byte first) followed
+// by quantity bytes of data as a single transaction. data is sent straight
+// from the caller's array, so quantity is not limited by BUFFER_LENGTH.
+// Returns the same status as endTransmission().
+uint8_t TwoWire::writeTo(uint8_t address, uint32_t iaddress, uint8_t isize, const uint8_t *data, uint8_t quantity)
+{
+  uint8_t ibuf[4];
+  if(isize > sizeof ibuf){
+    isize = sizeof ibuf;
+  }
+  for(uint8_t i = 0; i < isize; i++){
+    ibuf[i] = iaddress >> (8 * (isize - 1 - i));
+  }
+  return twi_writeFrom(address, ibuf, isize, data, quantity);
+}
+
+// Master transactions which ended with a NACK, lost arbitration or a bus
+// error. Wraps at 0xFFFF, so take differences.
+uint16_t TwoWire::errors(void)
+{
+  return twi_errorCount();
+}
+
 uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
 {
   return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)true);
@@ -58,6 +58,9 @@ class TwoWire : public Stream
     uint8_t requestFrom(uint8_t, uint8_t, uint8_t);
     uint8_t requestFrom(int, int);
     uint8_t requestFrom(int, int, int);
+    uint8_t requestFrom(uint8_t, uint8_t, uint32_t, uint8_t);
+    uint8_t writeTo(uint8_t, uint32_t, uint8_t, const uint8_t *, uint8_t);
+    uint16_t errors(void);
     virtual size_t write(uint8_t);
     virtual size_t write(const uint8_t *, size_t);
     virtual int available(void);
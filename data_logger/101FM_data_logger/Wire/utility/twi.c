@@ -42,6 +42,9 @@ static volatile uint8_t twi_state;
 static volatile uint8_t twi_slarw;
 static volatile uint8_t twi_sendStop;			// should the transaction end with a stop
 static volatile uint8_t twi_inRepStart;			// in the middle of a repeated start
+static volatile uint8_t twi_readAfter;			// bytes to read after a repeated start once the write is done
+static const uint8_t* volatile twi_txData;		// bytes sent by twi_writeFrom after the master buffer
+static volatile uint8_t twi_txLeft;
 
 static void (*twi_onSlaveTransmit)(void);
 static void (*twi_onSlaveReceive)(uint8_t*, int);
@@ -58,6 +61,7 @@ static uint8_t twi_rxBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_rxBufferIndex;
 
 static volatile uint8_t twi_error;
+static volatile uint16_t twi_errors;			// master transactions ended by a NACK, lost arbitration or a bus error
 
 /* 
  * Function twi_init
@@ -253,6 +257,118 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
     return 4;	// other twi error
 }
 
+/* 
+ * Function twi_writeFrom
+ * Desc     attempts to become twi bus master and write a header (e.g. a
+ *          memory address) followed by a series of bytes which are sent
+ *          by the ISR straight from the caller's array. The series is not
+ *          copied and is not limited to TWI_BUFFER_LENGTH. Waits for the
+ *          write to complete and ends it with a stop.
+ * Input    address: 7bit i2c device address
+ *          head: pointer to byte array to send first
+ *          headLength: number of bytes in head
+ *          data: pointer to byte array to send after head
+ *          length: number of bytes in data
+ * Output   see twi_writeTo
+ */
+uint8_t twi_writeFrom(uint8_t address, uint8_t* head, uint8_t headLength, const uint8_t* data, uint8_t length)
+{
+  // wait until twi is ready, the ISR may still be sending the last series
+  while(TWI_READY != twi_state){
+    continue;
+  }
+  twi_txData = data;
+  twi_txLeft = length;
+  uint8_t rv = twi_writeTo(address, head, headLength, 1, true);
+  twi_txLeft = 0;  // whatever was left after a nack
+  return rv;
+}
+
+/* 
+ * Function twi_writeRead
+ * Desc     attempts to become twi bus master, write a series of bytes
+ *          (usually a register address) to a device and read a series of
+ *          bytes back after a repeated start, all as one transaction.
+ *          The switch from writing to reading is done by the ISR, so
+ *          there is no stop, no bus free time and no new arbitration
+ *          between the two halves.
+ * Input    address: 7bit i2c device address
+ *          txData: pointer to byte array to write
+ *          txLength: number of bytes to write
+ *          rxData: pointer to byte array to read into
+ *          rxLength: number of bytes to read
+ * Output   number of bytes read, 0 on any error
+ */
+uint8_t twi_writeRead(uint8_t address, const uint8_t* txData, uint8_t txLength, uint8_t* rxData, uint8_t rxLength)
+{
+  uint8_t i;
+
+  // ensure data will fit into buffer
+  if(TWI_BUFFER_LENGTH < txLength || TWI_BUFFER_LENGTH < rxLength || 0 == rxLength){
+    return 0;
+  }
+
+  // wait until twi is ready, become master transmitter
+  while(TWI_READY != twi_state){
+    continue;
+  }
+  twi_state = TWI_MTX;
+  twi_sendStop = true;
+  twi_readAfter = rxLength;
+  // reset error state (0xFF.. no error occured)
+  twi_error = 0xFF;
+
+  // initialize buffer iteration vars
+  twi_masterBufferIndex = 0;
+  twi_masterBufferLength = txLength;
+  for(i = 0; i < txLength; ++i){
+    twi_masterBuffer[i] = txData[i];
+  }
+
+  // build sla+w, slave device address + w bit
+  twi_slarw = TW_WRITE;
+  twi_slarw |= address << 1;
+
+  if (true == twi_inRepStart) {
+    // see twi_writeTo
+    twi_inRepStart = false;
+    TWDR = twi_slarw;
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE);
+  }
+  else
+    TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);
+
+  // wait for both halves to complete
+  while(TWI_MTX == twi_state || TWI_MRX == twi_state){
+    continue;
+  }
+  twi_readAfter = 0;
+
+  if (twi_error != 0xFF || twi_masterBufferIndex < rxLength){
+    return 0;
+  }
+  for(i = 0; i < rxLength; ++i){
+    rxData[i] = twi_masterBuffer[i];
+  }
+  return rxLength;
+}
+
+/* 
+ * Function twi_errorCount
+ * Desc     number of master transactions which ended with a NACK, lost
+ *          arbitration or a bus error since twi_init. Wraps at 0xFFFF.
+ * Input    none
+ * Output   error count
+ */
+uint16_t twi_errorCount(void)
+{
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t n = twi_errors;
+  SREG = sreg;
+  return n;
+}
+
 /* 
  * Function twi_transmit
  * Desc     fills slave tx buffer with data
@@ -379,6 +495,19 @@ ISR(TWI_vect)
         // copy data to output register and ack
         TWDR = twi_masterBuffer[twi_masterBufferIndex++];
         twi_reply(1);
+      }else if(twi_txLeft){
+        // twi_writeFrom: rest of the data straight from the caller
+        TWDR = *twi_txData++;
+        twi_txLeft--;
+        twi_reply(1);
+      }else if(twi_readAfter){
+        // twi_writeRead: turn around into master receiver right here
+        twi_state = TWI_MRX;
+        twi_slarw = TW_READ | (twi_slarw & 0xFE);
+        twi_masterBufferIndex = 0;
+        twi_masterBufferLength = twi_readAfter - 1;  // see twi_readFrom
+        twi_readAfter = 0;
+        TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN) | _BV(TWIE) | _BV(TWEA);
       }else{
 	if (twi_sendStop)
           twi_stop();
@@ -394,14 +523,17 @@ ISR(TWI_vect)
       break;
     case TW_MT_SLA_NACK:  // address sent, nack received
       twi_error = TW_MT_SLA_NACK;
+      twi_errors++;
       twi_stop();
       break;
     case TW_MT_DATA_NACK: // data sent, nack received
       twi_error = TW_MT_DATA_NACK;
+      twi_errors++;
       twi_stop();
       break;
     case TW_MT_ARB_LOST: // lost bus arbitration
       twi_error = TW_MT_ARB_LOST;
+      twi_errors++;
       twi_releaseBus();
       break;
 
@@ -433,6 +565,7 @@ ISR(TWI_vect)
 	}    
 	break;
     case TW_MR_SLA_NACK: // address sent, nack received
+      twi_errors++;
       twi_stop();
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
@@ -522,6 +655,7 @@ ISR(TWI_vect)
       break;
     case TW_BUS_ERROR: // bus error, illegal stop/start
       twi_error = TW_BUS_ERROR;
+      twi_errors++;
       twi_stop();
       break;
   }
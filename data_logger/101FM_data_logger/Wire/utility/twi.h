@@ -42,6 +42,9 @@
   void twi_setAddress(uint8_t);
   uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
   uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t, uint8_t);
+  uint8_t twi_writeFrom(uint8_t, uint8_t*, uint8_t, const uint8_t*, uint8_t);
+  uint8_t twi_writeRead(uint8_t, const uint8_t*, uint8_t, uint8_t*, uint8_t);
+  uint16_t twi_errorCount(void);
   uint8_t twi_transmit(const uint8_t*, uint8_t);
   void twi_attachSlaveRxEvent( void (*)(uint8_t*, int) );
   void twi_attachSlaveTxEvent( void (*)(void) );
@@ -0,0 +1,132 @@
+/**
+ * Per channel record chains.
+ *
+ * Every LogRecord of a channel carries in its spare field the distance, in sequence numbers, back to the previous
+ * record of the same channel. 0 means the channel has no earlier record, 0xffff that the previous one is not known
+ * (records written before chains existed, the channel was quiet for more than 0xfffe records, or it was not seen by
+ * the scan at boot). The newest record of each channel is kept in chain_last, the in-RAM side of the channel table.
+ *
+ * /log?ch=b<bank>c<pin> then follows the chain from the newest record of the channel and costs one read per line
+ * instead of a scan through everything logged since. Where a chain has a 0xffff link the cursor falls back to
+ * scanning, CHAIN_SCAN_BURST records per call, until it finds the next record of the channel.
+ *
+ * A link pointing below binlog_tail() went to a record the ring has overwritten (or /clr has hidden) and ends the
+ * chain. A link leading to a record of another channel, or one failing its CRC, is reported as a broken chain.
+ */
+
+#include "101FM_data_logger.h"
+
+#ifdef LOG_BINARY
+
+#define CHAIN_NONE 0xffffffff
+
+static uint32_t chain_last[2][16]; // sequence number of the newest record of each channel, CHAIN_NONE if unknown
+static uint8_t chain_complete; // the boot scan reached the tail. channels it did not see have no record at all.
+
+/**
+ * Finds the newest record of each channel by scanning back from the head, at most CHAIN_SCAN_MAX records.
+ * Call after binlog_begin() and after a /clr.
+ */
+void chain_begin() {
+    memset(chain_last, 0xff, sizeof chain_last);
+    uint8_t left = 32;
+    uint32_t seq = binlog_head();
+    uint32_t floor = binlog_tail();
+    if (seq - floor > CHAIN_SCAN_MAX) {
+        floor = seq - CHAIN_SCAN_MAX;
+    }
+    struct LogRecord r;
+    while (left && seq != floor) {
+        seq--;
+        if (binlog_read(seq, &r) && r.bank < 2 && r.pin < 16 && chain_last[r.bank][r.pin] == CHAIN_NONE) {
+            chain_last[r.bank][r.pin] = seq;
+            left--;
+        }
+    }
+    chain_complete = !left || floor == binlog_tail();
+}
+
+/**
+ * Link for record r, whose seq is filled in, to the previous record of its channel. Makes r the newest record of
+ * the channel.
+ */
+uint16_t chain_link(const struct LogRecord *r) {
+    if (r->bank > 1 || r->pin > 15) {
+        return 0xffff;
+    }
+    uint32_t last = chain_last[r->bank][r->pin];
+    chain_last[r->bank][r->pin] = r->seq;
+    if (last == CHAIN_NONE) {
+        return chain_complete ? 0 : 0xffff;
+    }
+    return r->seq - last < 0xffff ? r->seq - last : 0xffff;
+}
+
+/**
+ * Starts walking the records of one channel from its newest one. Returns 0 if the channel has nothing logged.
+ */
+uint8_t chain_open(struct LogCursor *c, uint8_t bank, uint8_t pin) {
+    uint32_t last = chain_last[bank][pin];
+    c->end = binlog_tail();
+    c->epoch = 0;
+    c->bank = bank;
+    c->pin = pin;
+    c->scan = 0;
+    if (last != CHAIN_NONE) {
+        c->pos = last + 1;
+    } else if (chain_complete) {
+        c->pos = c->end;
+    } else { // quiet since before the boot scan window, if it ever logged
+        c->pos = binlog_head() - CHAIN_SCAN_MAX;
+        c->scan = 1;
+    }
+    return c->pos != c->end;
+}
+
+/**
+ * log_prev() for a cursor opened by chain_open(). Returns 0 without a line while it is still scanning for the next
+ * record of the channel.
+ */
+uint8_t chain_prev(struct LogCursor *c, char *line) {
+    struct LogRecord r;
+    if (c->pos - 1 < binlog_tail()) {
+        char tmp[65];
+        sprintf(tmp, "%-10lu %-53s", c->pos - 1, "chain ends. older records overwritten or cleared");
+        memcpy(line, tmp, 64);
+        c->pos = c->end;
+        return 1;
+    }
+    if (c->scan) {
+        for (uint8_t n = 0; n < CHAIN_SCAN_BURST && c->pos != c->end; n++) {
+            c->pos--;
+            if (binlog_read(c->pos, &r) && r.bank == c->bank && r.pin == c->pin) {
+                c->scan = 0;
+                break;
+            }
+        }
+        if (c->scan) {
+            return 0;
+        }
+    } else {
+        c->pos--;
+        if (!binlog_read(c->pos, &r) || r.bank != c->bank || r.pin != c->pin) {
+            char tmp[65];
+            sprintf(tmp, "%-10lu %-53s", c->pos, "chain broken");
+            memcpy(line, tmp, 64);
+            c->pos = c->end;
+            return 1;
+        }
+    }
+    format_record(&r, line);
+    metrics_delivered(c->pos, DELIVER_HTTP);
+    if (r.spare == 0) {
+        c->pos = c->end;
+    } else if (r.spare == 0xffff) {
+        c->scan = 1;
+    } else {
+        c->pos -= r.spare - 1; // one past the previous record
+    }
+    return 1;
+}
+
+#endif
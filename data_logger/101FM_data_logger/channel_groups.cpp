@@ -0,0 +1,141 @@
+/**
+ * Channel groups.
+ *
+ * A group is 2 to 4 adjacent pins of one bank carrying a binary code, e.g. the fault code of a transmitter. When the
+ * code changes several pins flip within a few microseconds of each other and logging every pin separately would
+ * record intermediate codes that never really existed. Instead a change on any pin of a group only arms a settle
+ * timer. Once the group has been quiet for GROUP_SETTLE_MS all its pins are taken from one GPIO snapshot and
+ * a single event carrying the decoded value is logged, provided the value differs from the last one logged.
+ *
+ * Groups are defined in the channel table on the header 24LC512. The byte right after the 40 character name of the
+ * first pin of a group holds the group width. 0xff (blank EEPROM) or 1 means the pin is a plain channel.
+ *
+ * Reading GPIO clears a pending interrupt of the chip, including one raised by a plain channel of the same bank. The
+ * snapshot is therefore read together with INTF and INTCAP in a single transaction, and a change found there is
+ * queued as a capture. Only a change landing within the few microseconds of that transaction, between the INTCAP and
+ * the GPIO bytes, can still go unseen.
+ */
+
+#include "101FM_data_logger.h"
+
+static uint16_t grp_first[2]; // bit n set when pin n is the first pin of a group
+static uint16_t grp_bits[2]; // bit n set when pin n belongs to a group
+static uint16_t grp_pending[2]; // first pins of groups waiting to settle
+static uint16_t grp_last[2]; // port values of grouped pins as last logged
+static uint32_t grp_due[2]; // millis() at which pending groups of the bank are settled
+static uint32_t grp_tick[2]; // capture tick of the first change since the bank had no group pending
+
+static Adafruit_MCP23017 *bank_mcp(uint8_t bank) {
+    return bank ? &mcp1 : &mcp0;
+}
+
+/**
+ * Width of the group starting at pin, taken from the in-RAM table.
+ */
+static uint8_t group_width(uint8_t bank, uint8_t pin) {
+    uint8_t width = 1;
+    while (pin + width < 16 && (grp_bits[bank] & (1 << (pin + width))) && !(grp_first[bank] & (1 << (pin + width)))) {
+        width++;
+    }
+    return width;
+}
+
+/**
+ * First pin of the group pin belongs to.
+ */
+static uint8_t group_of(uint8_t bank, uint8_t pin) {
+    while (!(grp_first[bank] & (1 << pin))) {
+        pin--;
+    }
+    return pin;
+}
+
+/**
+ * Loads the group definitions from the channel table and takes the current port values as the last logged ones.
+ * The MCP23017s must be set up already.
+ */
+void group_begin() {
+    for (uint8_t bank = 0; bank < 2; bank++) {
+        grp_first[bank] = 0;
+        grp_bits[bank] = 0;
+        grp_pending[bank] = 0;
+        for (uint8_t pin = 0; pin < 16; pin++) {
+            uint8_t width = ee_h.readByte(CHANNEL_ADDR(bank, pin) + CHANNEL_GROUP_OFFSET);
+            if (width < 2 || width > GROUP_WIDTH_MAX || pin + width > 16 || (grp_bits[bank] & (1 << pin))) {
+                continue; // plain channel, bad width or overlapping an earlier group
+            }
+            grp_first[bank] |= 1 << pin;
+            grp_bits[bank] |= ((1 << width) - 1) << pin;
+        }
+        grp_last[bank] = grp_bits[bank] ? bank_mcp(bank)->readGPIOAB() & grp_bits[bank] : 0;
+    }
+}
+
+/**
+ * Defines a group of width pins starting at pin. A width of 1 turns the pin back into a plain channel.
+ * Returns 0 if the group does not fit into the bank.
+ */
+uint8_t group_set(uint8_t bank, uint8_t pin, uint8_t width) {
+    if (bank > 1 || pin > 15 || width < 1 || width > GROUP_WIDTH_MAX || pin + width > 16) {
+        return 0;
+    }
+    ee_h.writeByte(CHANNEL_ADDR(bank, pin) + CHANNEL_GROUP_OFFSET, width == 1 ? 0xff : width);
+    group_begin();
+    return 1;
+}
+
+/**
+ * Takes the grouped pins out of a capture and arms the settle timer of their groups. Returns the pins left to be
+ * logged one by one.
+ */
+uint16_t group_capture(struct Capture *c) {
+    uint16_t grouped = c->intf & grp_bits[c->bank];
+    if (!grouped) {
+        return c->intf;
+    }
+    if (!grp_pending[c->bank]) {
+        grp_tick[c->bank] = c->tick;
+    }
+    for (uint8_t pin = 0; pin < 16; pin++) {
+        if (grouped & (1 << pin)) {
+            grp_pending[c->bank] |= 1 << group_of(c->bank, pin);
+        }
+    }
+    grp_due[c->bank] = millis() + GROUP_SETTLE_MS; // any change restarts settling
+    return c->intf & ~grouped;
+}
+
+/**
+ * Logs groups which have settled. Call from loop() after the capture queue has been drained.
+ */
+void group_poll() {
+    for (uint8_t bank = 0; bank < 2; bank++) {
+        if (!grp_pending[bank] || (int32_t) (millis() - grp_due[bank]) < 0) {
+            continue;
+        }
+        if (!(PIND & (bank ? INTPIN1 : INTPIN0))) {
+            continue; // an interrupt is waiting to be captured. let handleInterrupt() have it first.
+        }
+        uint16_t intf, intcap, gpio;
+        if (!bank_mcp(bank)->readInterruptState(&intf, &intcap, &gpio)) {
+            capq_errors++;
+            continue; // try again on the next pass
+        }
+        if (intf) { // a change came in after the check above. the GPIO read has cleared it, so queue it here.
+            capture_push(bank, intf, intcap, int_tick[bank]);
+        }
+        rtc_get(&t);
+        for (uint8_t pin = 0; pin < 16; pin++) {
+            if (!(grp_pending[bank] & (1 << pin))) {
+                continue;
+            }
+            uint8_t width = group_width(bank, pin);
+            uint16_t mask = ((1 << width) - 1) << pin;
+            if ((gpio & mask) != (grp_last[bank] & mask)) {
+                record_event(bank, pin, (gpio & mask) >> pin, LOG_REC_GROUP, grp_tick[bank]);
+                grp_last[bank] = (grp_last[bank] & ~mask) | (gpio & mask);
+            }
+        }
+        grp_pending[bank] = 0;
+    }
+}
@@ -96,11 +96,7 @@ void DS3231_get(struct ts *t)
     uint8_t i, n;
     uint16_t year_full;
 
-    Wire.beginTransmission(DS3231_I2C_ADDR);
-    Wire.write(DS3231_TIME_CAL_ADDR);
-    Wire.endTransmission();
-
-    Wire.requestFrom(DS3231_I2C_ADDR, 7);
+    Wire.requestFrom(DS3231_I2C_ADDR, 7, DS3231_TIME_CAL_ADDR, 1);
 
     for (i = 0; i <= 6; i++) {
         n = Wire.read();
@@ -142,11 +138,7 @@ uint8_t DS3231_get_addr(const uint8_t addr)
 {
     uint8_t rv;
 
-    Wire.beginTransmission(DS3231_I2C_ADDR);
-    Wire.write(addr);
-    Wire.endTransmission();
-
-    Wire.requestFrom(DS3231_I2C_ADDR, 1);
+    Wire.requestFrom(DS3231_I2C_ADDR, 1, addr, 1);
     rv = Wire.read();
 
     return rv;
@@ -220,11 +212,7 @@ float DS3231_get_treg()
     uint8_t temp_msb, temp_lsb;
     int8_t nint;
 
-    Wire.beginTransmission(DS3231_I2C_ADDR);
-    Wire.write(DS3231_TEMPERATURE_ADDR);
-    Wire.endTransmission();
-
-    Wire.requestFrom(DS3231_I2C_ADDR, 2);
+    Wire.requestFrom(DS3231_I2C_ADDR, 2, DS3231_TEMPERATURE_ADDR, 1);
     temp_msb = Wire.read();
     temp_lsb = Wire.read() >> 6;
 
@@ -267,11 +255,7 @@ void DS3231_get_a1(char *buf, const uint8_t len)
     uint8_t f[5];               // flags
     uint8_t i;
 
-    Wire.beginTransmission(DS3231_I2C_ADDR);
-    Wire.write(DS3231_ALARM1_ADDR);
-    Wire.endTransmission();
-
-    Wire.requestFrom(DS3231_I2C_ADDR, 4);
+    Wire.requestFrom(DS3231_I2C_ADDR, 4, DS3231_ALARM1_ADDR, 1);
 
     for (i = 0; i <= 3; i++) {
         n[i] = Wire.read();
@@ -329,11 +313,7 @@ void DS3231_get_a2(char *buf, const uint8_t len)
     uint8_t f[4];               // flags
     uint8_t i;
 
-    Wire.beginTransmission(DS3231_I2C_ADDR);
-    Wire.write(DS3231_ALARM2_ADDR);
-    Wire.endTransmission();
-
-    Wire.requestFrom(DS3231_I2C_ADDR, 3);
+    Wire.requestFrom(DS3231_I2C_ADDR, 3, DS3231_ALARM2_ADDR, 1);
 
     for (i = 0; i <= 2; i++) {
         n[i] = Wire.read();
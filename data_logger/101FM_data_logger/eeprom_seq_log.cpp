@@ -0,0 +1,258 @@
+/**
+ * Header free event log on the data 24LC512.
+ *
+ * The data EEPROM is a ring of 4096 LogRecords and every record lives at slot seq % 4096, so records are
+ * self describing and no header has to be written per event. That halves the EEPROM write operations (and the
+ * I²C bus time) of every event compared to LOG_BACKEND_EEPROM.
+ *
+ * Slot 0 is the first slot written in every lap around the ring. At boot its sequence number tells the current lap
+ * and a binary search finds the first slot which does not hold the sequence number expected for this lap. That is
+ * the head. The tail is simply one full ring behind the head.
+ *
+ * /clr is the only thing that needs persisting elsewhere. Its epoch is written as a checkpoint into the same wear
+ * levelled header slots of the header 24LC512 used by LOG_BACKEND_EEPROM: inv(unixtime) followed by the first
+ * sequence number visible after the clear.
+ *
+ * Records are not written to the 24LC512 one by one. They land in a hot tier first, a ring of HOT_SLOTS records in
+ * the scratch memory of the network chip, which takes a record in a few tens of μs. binlog_poll() migrates them to the
+ * 24LC512 (the cold tier) a page at a time, so 8 records cost one page write cycle instead of 8. A partly filled
+ * page is migrated as well once its oldest record has been hot for HOT_HOLD_MS, and the power-fail last gasp migrates
+ * whatever is hot, which is why this backend needs POWERFAIL_ADC. Reads look in both tiers. The arrival time of the
+ * first hot record of each page is kept in RAM, so records left hot after a migration keep their age.
+ *
+ * The last scratch page of the hot tier holds the capture tick of each hot record. A record counts as committed for
+ * the latency telemetry when it reaches the 24LC512, so metrics_commit() is called by migrate().
+ */
+
+#include "101FM_data_logger.h"
+
+#if LOG_BACKEND == LOG_BACKEND_EEPROM_SEQ
+
+#define SEQ_SLOTS (0x10000UL / sizeof(struct LogRecord))
+#define PAGE_RECORDS (I2C_EEPROM_PAGESIZE / sizeof(struct LogRecord))
+#define HOT_SLOTS ((HOT_PAGES - 1) * 64 / sizeof(struct LogRecord))
+#define HOT_TICK_PAGE (REC_PAGES + HOT_PAGES - 1)
+#define HOT_PER_PAGE (64 / sizeof(struct LogRecord))
+#define HOT_HOLD_MS 10000
+#define HOT_SPAN (HOT_SLOTS / PAGE_RECORDS + 1) // 24LC512 pages the hot records can be spread over
+
+static uint32_t sl_head; // sequence number of the next record
+static uint32_t sl_cold; // sequence number of the oldest record in the hot tier. sl_head when it is empty.
+static uint32_t sl_clear; // first sequence number after the last /clr
+static uint32_t sl_hot_since; // millis() when the oldest hot record came in
+static uint32_t sl_arrive[HOT_SPAN]; // millis() when the first hot record of each page came in, by page % HOT_SPAN
+uint32_t tier_writes = 0; // page writes of the migration
+uint32_t tier_records = 0; // records migrated
+
+static uint16_t seq_addr(uint32_t seq) {
+    return (uint16_t) (seq % SEQ_SLOTS) * sizeof(struct LogRecord);
+}
+
+static uint32_t read_seq(uint16_t slot) {
+    uint32_t seq;
+    ee_d.readBlock(slot * sizeof(struct LogRecord), (uint8_t*) &seq, sizeof seq);
+    return seq;
+}
+
+static void hot_put(const struct LogRecord *r, uint32_t tick) {
+    uint8_t slot = r->seq % HOT_SLOTS;
+    net_scratch_write(REC_PAGES + slot / HOT_PER_PAGE, (slot % HOT_PER_PAGE) * sizeof *r, (const uint8_t*) r, sizeof *r);
+    net_scratch_write(HOT_TICK_PAGE, slot * sizeof tick, (const uint8_t*) &tick, sizeof tick);
+}
+
+static void hot_get(uint32_t seq, struct LogRecord *r) {
+    uint8_t slot = seq % HOT_SLOTS;
+    uint8_t page = REC_PAGES + slot / HOT_PER_PAGE;
+    uint8_t off = (slot % HOT_PER_PAGE) * sizeof *r;
+    for (uint8_t i = 0; i < sizeof *r; i++) {
+        ((uint8_t*) r)[i] = net_scratch_read(page, off + i);
+    }
+}
+
+static uint32_t hot_tick(uint32_t seq) {
+    uint8_t slot = seq % HOT_SLOTS;
+    uint32_t tick;
+    for (uint8_t i = 0; i < sizeof tick; i++) {
+        ((uint8_t*) &tick)[i] = net_scratch_read(HOT_TICK_PAGE, slot * sizeof tick + i);
+    }
+    return tick;
+}
+
+/**
+ * Moves the oldest hot records, up to the end of the 24LC512 page they go to, to the cold tier with a single page
+ * write, and reports the events among them as committed. Returns 0 if the write failed. The records stay hot then.
+ */
+static uint8_t migrate() {
+    uint32_t end = sl_cold - sl_cold % PAGE_RECORDS + PAGE_RECORDS;
+    if (end > sl_head) {
+        end = sl_head;
+    }
+    uint8_t n = end - sl_cold;
+    struct LogRecord page[PAGE_RECORDS];
+    for (uint8_t i = 0; i < n; i++) {
+        hot_get(sl_cold + i, &page[i]);
+    }
+    uint16_t addr = seq_addr(sl_cold);
+    PORTD |= EEPLED;	// turn on EEPLED to show eeprom usage
+    uint8_t rv = ee_d.writeBlock(addr, (uint8_t*) page, n * sizeof(struct LogRecord)) == 0;
+    if (rv) {
+        hash_written(addr, (uint8_t*) page, n * sizeof(struct LogRecord));
+        for (uint8_t i = 0; i < n; i++) {
+            if (!(page[i].flags & (LOG_REC_CLEAR | LOG_REC_POWER))) {
+                metrics_commit(sl_cold + i, hot_tick(sl_cold + i));
+            }
+        }
+        sl_cold = end;
+        sl_hot_since = sl_arrive[sl_cold / PAGE_RECORDS % HOT_SPAN]; // any leftover starts a page
+        tier_writes++;
+        tier_records += n;
+    } else {
+        hash_invalidate(addr);
+        Serial.println("error writing data to ee_d!");
+    }
+    PORTD &= ~EEPLED;	// turn off EEPLED
+    return rv;
+}
+
+/**
+ * Writes the /clr epoch into the next wear levelled header slot.
+ */
+static void write_checkpoint() {
+    struct ts tm;
+    uint8_t block[8];
+    rtc_get(&tm);
+    uint32_t inv = 0xffffffff - tm.unixtime;
+    for (uint8_t i = 0; i < 4; i++) {
+        block[i] = (uint8_t) (inv >> (8 * i));
+        block[4 + i] = (uint8_t) (sl_clear >> (8 * i));
+    }
+    dh_addr -= 0x0080;
+    if (dh_addr == SELFTEST_END - 0x0080) {
+        dh_addr = 0xff80;
+    }
+    if (ee_h.writeBlock(dh_addr, block, 8)) {
+        Serial.println("error writing data to ee_h!");
+    }
+}
+
+/**
+ * Finds the head. dh_addr must already point at the newest header slot (see setup()).
+ */
+uint8_t binlog_begin() {
+    uint8_t block[8];
+    ee_h.readBlock(dh_addr, block, 8);
+    sl_clear = 0;
+    if (block[0] != 0xff || block[1] != 0xff || block[2] != 0xff || block[3] != 0xff) { // blank slots mean no /clr yet
+        for (uint8_t i = 0; i < 4; i++) {
+            sl_clear |= (uint32_t) block[4 + i] << (8 * i);
+        }
+    }
+
+    uint32_t lap = read_seq(0);
+    if (lap == 0xffffffff) { // nothing logged yet
+        sl_head = 0;
+        sl_cold = 0;
+        return 1;
+    }
+    lap -= lap % SEQ_SLOTS; // slot 0 always holds the first record of a lap
+
+    uint16_t lo = 1, hi = SEQ_SLOTS;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) / 2;
+        if (read_seq(mid) == lap + mid) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    sl_head = lap + lo;
+    sl_cold = sl_head;
+    if (sl_clear > sl_head) { // checkpoint from a log that has been wiped since
+        sl_clear = sl_head;
+    }
+    return 1;
+}
+
+/**
+ * Migrates a full page worth of hot records, or a partial page which has been hot for too long.
+ */
+void binlog_poll() {
+    if (sl_cold == sl_head) {
+        return;
+    }
+    if (sl_head >= sl_cold - sl_cold % PAGE_RECORDS + PAGE_RECORDS || millis() - sl_hot_since >= HOT_HOLD_MS) {
+        migrate();
+    }
+}
+
+/**
+ * Migrates everything hot. For the power-fail last gasp.
+ */
+void binlog_flush() {
+    while (sl_cold != sl_head && migrate())
+        ;
+}
+
+/**
+ * Number of records in the hot tier.
+ */
+uint8_t binlog_hot() {
+    return sl_head - sl_cold;
+}
+
+/**
+ * Appends a record to the hot tier. seq and crc are filled in here. tick is micros() at the interrupt behind the
+ * event, kept until the record is migrated. Only when the hot tier is full, because binlog_poll() has not been called
+ * for a while, the oldest page is migrated first.
+ */
+uint8_t binlog_append(struct LogRecord *r, uint32_t tick) {
+    if (sl_head - sl_cold == HOT_SLOTS && !migrate()) {
+        return 0;
+    }
+    r->seq = sl_head;
+    r->spare = chain_link(r);
+    r->crc = log_record_crc(r);
+    hot_put(r, tick);
+    if (sl_cold == sl_head || sl_head % PAGE_RECORDS == 0) {
+        sl_arrive[sl_head / PAGE_RECORDS % HOT_SPAN] = millis();
+    }
+    if (sl_cold == sl_head) {
+        sl_hot_since = millis();
+    }
+    sl_head++;
+    return 1;
+}
+
+/**
+ * Reads the record with sequence number seq. Returns 0 if it is out of range or does not pass the CRC check.
+ */
+uint8_t binlog_read(uint32_t seq, struct LogRecord *r) {
+    if (seq < binlog_tail() || seq >= sl_head) {
+        return 0;
+    }
+    if (seq >= sl_cold) {
+        hot_get(seq, r);
+    } else {
+        ee_d.readBlock(seq_addr(seq), (uint8_t*) r, sizeof(struct LogRecord));
+    }
+    return r->seq == seq && r->crc == log_record_crc(r);
+}
+
+/**
+ * Hides everything logged so far. Costs one checkpoint write and nothing on the data EEPROM.
+ */
+void binlog_clear(uint32_t time) {
+    sl_clear = sl_head;
+    write_checkpoint();
+}
+
+uint32_t binlog_head() {
+    return sl_head;
+}
+
+uint32_t binlog_tail() {
+    uint32_t oldest = sl_head > SEQ_SLOTS ? sl_head - SEQ_SLOTS : 0;
+    return oldest > sl_clear ? oldest : sl_clear;
+}
+
+#endif
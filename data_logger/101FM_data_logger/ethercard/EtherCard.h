@@ -39,6 +39,8 @@
 #include "enc28j60.h"
 #include "net.h"
 
+#define HTTP_REPLY_STATE_LEN 0x36 ///< Ethernet, IP and TCP headers of a reply, see EtherCard::httpServerReplySave()
+
 /** This type definition defines the structure of a UDP server event handler callback funtion */
 typedef void (*UdpServerCallback)(
     uint16_t dest_port,    ///< Port the packet was sent to
@@ -224,6 +226,76 @@ public:
     virtual WRITE_RESULT write (uint8_t v) { *ptr++ = v; WRITE_RETURN }
 };
 
+/** This class writes the payload of a HTTP server reply straight into the TCP payload area of the packet buffer.
+*
+*   Nothing is staged in a separate buffer. Output accumulates in place and goes out as one segment whenever the
+*   payload area fills up and on flush(). close() sends what is left with FIN set. A reply too long to be sent in one
+*   go can be parked with save() while other packets are received and continued later with restore().
+*
+*   Example:
+*   ~~~~~~~~~~~~~{.c}
+*     HttpReply out;
+*     out.begin();
+*     out.write_P(txt_header_200);
+*     out.printf("%04d-%02d-%02d\n", t.year, t.mon, t.mday);
+*     out.close();
+*   ~~~~~~~~~~~~~
+*/
+class HttpReply : public Print {
+    uint16_t len; //!< Bytes written to the payload area and not sent yet
+
+    uint16_t room () const;
+
+public:
+    HttpReply () : len (0) {}
+
+    /** @brief  Acknowledge the request in the packet buffer and start the reply
+    */
+    void begin ();
+
+    /** @brief  Add a program space string
+    *   @param  s Program space string pointer
+    */
+    void write_P (PGM_P s);
+
+    /** @brief  Add formatted text, sprintf style
+    *   @param  fmt Format string
+    *   @note   Formatted in place. Text which does not fit into the current segment is formatted again into the next.
+    */
+    void printf (const char *fmt, ...);
+
+    /** @brief  Get room for n bytes to be filled in place, sending the current segment first if needed
+    *   @param  n Number of bytes. Must not exceed the payload area.
+    *   @return <i>char*</i> Pointer into the payload area. Call commit() once filled in.
+    */
+    char* reserve (uint8_t n);
+
+    /** @brief  Add n bytes filled in after reserve()
+    */
+    void commit (uint8_t n) { len += n; }
+
+    /** @brief  Send what has been written so far as one segment
+    */
+    void flush ();
+
+    /** @brief  Send what has been written so far with FIN, ending the reply
+    */
+    void close ();
+
+    /** @brief  Send what has been written so far and save the state of the reply
+    *   @param  state Buffer of HTTP_REPLY_STATE_LEN bytes
+    */
+    void save (uint8_t *state);
+
+    /** @brief  Continue a reply saved with save(). Overwrites the headers of any packet in the buffer.
+    *   @param  state Buffer of HTTP_REPLY_STATE_LEN bytes
+    */
+    void restore (const uint8_t *state);
+
+    virtual WRITE_RESULT write (uint8_t v);
+    virtual WRITE_RESULT write (const uint8_t *buffer, size_t size);
+};
+
 /** This class provides the main interface to a ENC28J60 based network interface card and is the class most users will use.
 *   @note   All TCP/IP client (outgoing) connections are made from source port in range 2816-3071. Do not use these source ports for other purposes.
 */
@@ -303,6 +375,18 @@ public:
     */
     static void httpServerReplyAck ();
 
+    /**   @brief  Save the state of a reply in progress
+    *     @param  state Buffer of HTTP_REPLY_STATE_LEN bytes
+    *     @note   Lets a long reply be continued later with httpServerReplyRestore() while other packets are received in between
+    */
+    static void httpServerReplySave (uint8_t *state);
+
+    /**   @brief  Continue a reply saved with httpServerReplySave()
+    *     @param  state Buffer of HTTP_REPLY_STATE_LEN bytes
+    *     @note   Call before httpServerReply_with_flags(). Overwrites the headers of any packet in the buffer.
+    */
+    static void httpServerReplyRestore (const uint8_t *state);
+
     /**   @brief  Set the gateway address
     *     @param  gwipaddr Gateway address (4 bytes)
     */
@@ -16,6 +16,8 @@
 #include "enc28j60.h"
 
 uint16_t ENC28J60::bufferSize;
+uint8_t ENC28J60::txStatus[ENC28J60_TX_SLOTS];
+uint16_t ENC28J60::txErrors;
 bool ENC28J60::broadcast_enabled = false;
 
 // ENC28J60 Control Registers
@@ -236,8 +238,9 @@ bool ENC28J60::broadcast_enabled = false;
 #define RXSTART_INIT        0x0000  // start of RX buffer, room for 2 packets
 #define RXSTOP_INIT         0x0BFF  // end of RX buffer
 
-#define TXSTART_INIT        0x0C00  // start of TX buffer, room for 1 packet
+#define TXSTART_INIT        0x0C00  // start of TX buffer, split into ENC28J60_TX_SLOTS slots
 #define TXSTOP_INIT         0x11FF  // end of TX buffer
+#define TX_STATUS_VECTOR    7       // written by the chip right after the frame
 
 #define SCRATCH_START       0x1200  // start of scratch area
 #define SCRATCH_LIMIT       0x2000  // past end of area, i.e. 3.5 Kb
@@ -253,6 +256,10 @@ bool ENC28J60::broadcast_enabled = false;
 static byte Enc28j60Bank;
 static int gNextPacketPtr;
 static byte selectPin;
+static byte txSlots;         // slots in use, 1 if a full buffer does not fit twice
+static uint16_t txSlotSize;
+static byte txNext;          // slot the next frame is uploaded into
+static byte txActive = 0xFF; // slot handed to the MAC last, 0xFF if none
 
 void ENC28J60::initSPI () {
     pinMode(SS, OUTPUT);
@@ -383,6 +390,17 @@ byte ENC28J60::initialize (uint16_t size, const byte* macaddr, byte csPin) {
     writeReg(ERXND, RXSTOP_INIT);
     writeReg(ETXST, TXSTART_INIT);
     writeReg(ETXND, TXSTOP_INIT);
+    // every slot holds the control byte, a full data buffer and the status vector
+    txSlots = ENC28J60_TX_SLOTS;
+    txSlotSize = (TXSTOP_INIT + 1 - TXSTART_INIT) / txSlots;
+    if (size + 1 + TX_STATUS_VECTOR > txSlotSize) {
+        txSlots = 1;
+        txSlotSize = TXSTOP_INIT + 1 - TXSTART_INIT;
+    }
+    txNext = 0;
+    txActive = 0xFF;
+    for (byte i = 0; i < ENC28J60_TX_SLOTS; i++)
+        txStatus[i] = ENC28J60_TX_FREE;
     enableBroadcast(); // change to add ERXFCON_BCEN recommended by epam
     writeReg(EPMM0, 0x303f);
     writeReg(EPMCS, 0xf7f9);
@@ -417,19 +435,57 @@ bool ENC28J60::isLinkUp() {
     return (readPhyByte(PHSTAT2) >> 2) & 1;
 }
 
-void ENC28J60::packetSend(uint16_t len) {
-    // see http://forum.mysensors.org/topic/536/
-    // while (readOp(ENC28J60_READ_CTRL_REG, ECON1) & ECON1_TXRTS)
-    if (readRegByte(EIR) & EIR_TXERIF) {
+// Waits until the MAC is done with the slot it was handed last and records how it went.
+// A frame aborted by the MAC leaves TXERIF set and, on rev. B7, possibly TXRTS stuck
+// high (errata B7/12), so the transmit logic is reset in that case.
+static void txWait () {
+    if (ENC28J60::txStatus[txActive] != ENC28J60_TX_BUSY)
+        return;
+    byte eir;
+    while (((eir = readRegByte(EIR)) & EIR_TXERIF) == 0 &&
+            (readRegByte(ECON1) & ECON1_TXRTS))
+        ;
+    if ((eir & EIR_TXERIF) || (readRegByte(ESTAT) & ESTAT_TXABRT)) {
         writeOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRST);
-        writeOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST);
-        writeOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXERIF);
+        writeOp(ENC28J60_BIT_FIELD_CLR, ECON1, ECON1_TXRST|ECON1_TXRTS);
+        writeOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXERIF|EIR_TXIF);
+        writeOp(ENC28J60_BIT_FIELD_CLR, ESTAT, ESTAT_TXABRT);
+        ENC28J60::txStatus[txActive] = ENC28J60_TX_ERROR;
+        ENC28J60::txErrors++;
+    } else {
+        ENC28J60::txStatus[txActive] = ENC28J60_TX_DONE;
     }
-    writeReg(EWRPT, TXSTART_INIT);
-    writeReg(ETXND, TXSTART_INIT+len);
+}
+
+void ENC28J60::packetSend(uint16_t len) {
+    // see http://forum.mysensors.org/topic/536/
+    // Upload into the slot which is not on the wire, then wait for the previous
+    // frame only to hand the new one to the MAC. With one slot this degrades to
+    // waiting before the upload.
+    uint16_t start = TXSTART_INIT + txNext * txSlotSize;
+    if (txActive == txNext)
+        txWait();
+    txStatus[txNext] = ENC28J60_TX_LOADING;
+    writeReg(EWRPT, start);
     writeOp(ENC28J60_WRITE_BUF_MEM, 0, 0x00);
     writeBuf(len, buffer);
+    if (txActive != 0xFF)
+        txWait();
+    writeReg(ETXST, start);
+    writeReg(ETXND, start+len);
+    writeOp(ENC28J60_BIT_FIELD_CLR, EIR, EIR_TXIF);
     writeOp(ENC28J60_BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+    txStatus[txNext] = ENC28J60_TX_BUSY;
+    txActive = txNext;
+    if (++txNext >= txSlots)
+        txNext = 0;
+}
+
+byte ENC28J60::packetStatus(byte slot) {
+    if (slot == txActive && txStatus[slot] == ENC28J60_TX_BUSY &&
+            (readRegByte(ECON1) & ECON1_TXRTS) == 0)
+        txWait();
+    return txStatus[slot];
 }
 
 uint16_t ENC28J60::packetReceive() {
@@ -489,6 +545,14 @@ byte ENC28J60::peekin (byte page, byte off) {
     return result;
 }
 
+void ENC28J60::pokeout (byte page, byte off, const byte* data, byte len) {
+    uint16_t destPos = SCRATCH_START + (page << SCRATCH_PAGE_SHIFT) + off;
+    if (destPos < SCRATCH_START || destPos + len > SCRATCH_LIMIT)
+        return;
+    writeReg(EWRPT, destPos);
+    writeBuf(len, data);
+}
+
 // Contributed by Alex M. Based on code from: http://blog.derouineau.fr
 //                  /2011/07/putting-enc28j60-ethernet-controler-in-sleep-mode/
 void ENC28J60::powerDown() {
@@ -13,6 +13,17 @@
 #ifndef ENC28J60_H
 #define ENC28J60_H
 
+// Number of transmit slots in the chip's TX buffer. While the MAC sends the frame
+// in one slot the next frame is uploaded over SPI into another.
+#define ENC28J60_TX_SLOTS   2
+
+// Transmit slot states, see ENC28J60::packetStatus()
+#define ENC28J60_TX_FREE    0 //!< Never used
+#define ENC28J60_TX_LOADING 1 //!< Frame being uploaded over SPI
+#define ENC28J60_TX_BUSY    2 //!< Handed to the MAC, transmission pending or in progress
+#define ENC28J60_TX_DONE    3 //!< Transmitted
+#define ENC28J60_TX_ERROR   4 //!< Aborted by the MAC (collisions, late collision, underrun)
+
 /** This class provide low-level interfacing with the ENC28J60 network interface. This is used by the EtherCard class and not intended for use by (normal) end users. */
 class ENC28J60 {
 public:
@@ -20,6 +31,9 @@ public:
     static uint16_t bufferSize; //!< Size of data buffer
     static bool broadcast_enabled; //!< True if broadcasts enabled (used to allow temporary disable of broadcast for DHCP or other internal functions)
 
+    static uint8_t txStatus[ENC28J60_TX_SLOTS]; //!< State of each transmit slot
+    static uint16_t txErrors; //!< Number of aborted transmissions since initialize()
+
     static uint8_t* tcpOffset () { return buffer + 0x36; } //!< Pointer to the start of TCP payload
 
     /**   @brief  Initialise SPI interface
@@ -44,9 +58,16 @@ public:
     /**   @brief  Sends data to network interface
     *     @param  len Size of data to send
     *     @note   Data buffer is shared by recieve and transmit functions
+    *     @note   Returns as soon as the frame is in chip memory. The frame is uploaded while the previous one may still be on the wire and is only queued for transmission once that one has left.
     */
     static void packetSend (uint16_t len);
 
+    /**   @brief  Get state of a transmit slot
+    *     @param  slot Slot index, 0 to ENC28J60_TX_SLOTS - 1
+    *     @return <i>uint8_t</i> One of the ENC28J60_TX_* states
+    */
+    static uint8_t packetStatus (uint8_t slot);
+
     /**   @brief  Copy recieved packets to data buffer
     *     @return <i>uint16_t</i> Size of recieved data
     *     @note   Data buffer is shared by recieve and transmit functions
@@ -72,6 +93,14 @@ public:
     */
     static uint8_t peekin (uint8_t page, uint8_t off);
 
+    /**   @brief  Put data into ENC28J60 memory at any offset of a page
+    *     @param  page Data page of memory
+    *     @param  off Offset of data within page
+    *     @param  data Pointer to buffer to copy data from
+    *     @param  len Number of bytes, must not run past the last page
+    */
+    static void pokeout (uint8_t page, uint8_t off, const uint8_t* data, uint8_t len);
+
     /**   @brief  Put ENC28J60 in sleep mode
     */
     static void powerDown();  // contrib by Alex M.
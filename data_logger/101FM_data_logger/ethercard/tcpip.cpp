@@ -13,6 +13,7 @@
 
 #include "EtherCard.h"
 #include "net.h"
+#include <stdarg.h>
 #undef word // arduino nonsense
 
 #define gPB ether.buffer
@@ -293,6 +294,112 @@ void EtherCard::httpServerReplyAck () {
     get_seq(); //get the sequence number of packets after an ack from GET
 }
 
+void EtherCard::httpServerReplySave (uint8_t *state) {
+    memcpy(state, gPB, HTTP_REPLY_STATE_LEN);
+    state[TCP_SEQ_H_P]= (SEQ & 0xff000000 ) >> 24; // sequence number of the next segment
+    state[TCP_SEQ_H_P+1]= (SEQ & 0xff0000 ) >> 16;
+    state[TCP_SEQ_H_P+2]= (SEQ & 0xff00 ) >> 8;
+    state[TCP_SEQ_H_P+3]= (SEQ & 0xff );
+}
+
+void EtherCard::httpServerReplyRestore (const uint8_t *state) {
+    memcpy(gPB, state, HTTP_REPLY_STATE_LEN);
+    get_seq();
+}
+
+uint16_t HttpReply::room () const {
+    return EtherCard::bufferSize - (EtherCard::tcpOffset() - EtherCard::buffer) - len;
+}
+
+void HttpReply::begin () {
+    EtherCard::httpServerReplyAck();
+    len = 0;
+}
+
+void HttpReply::write_P (PGM_P s) {
+    for (;;) {
+        uint16_t n = strlen_P(s);
+        uint16_t r = room();
+        if (n <= r) {
+            memcpy_P(EtherCard::tcpOffset() + len, s, n);
+            len += n;
+            return;
+        }
+        memcpy_P(EtherCard::tcpOffset() + len, s, r);
+        len += r;
+        s += r;
+        flush();
+    }
+}
+
+void HttpReply::printf (const char *fmt, ...) {
+    va_list ap;
+    for (;;) {
+        uint16_t r = room();
+        va_start(ap, fmt);
+        int n = vsnprintf((char*) EtherCard::tcpOffset() + len, r, fmt, ap); // r includes the terminator
+        va_end(ap);
+        if (n < (int) r || len == 0) { // fits, or will never fit. cut short then.
+            len += n < (int) r ? n : r - 1;
+            return;
+        }
+        flush();
+    }
+}
+
+char* HttpReply::reserve (uint8_t n) {
+    if (n > room())
+        flush();
+    return (char*) EtherCard::tcpOffset() + len;
+}
+
+void HttpReply::flush () {
+    if (len) {
+        EtherCard::httpServerReply_with_flags(len, TCP_FLAGS_ACK_V);
+        len = 0;
+    }
+}
+
+void HttpReply::close () {
+    EtherCard::httpServerReply_with_flags(len, TCP_FLAGS_ACK_V|TCP_FLAGS_FIN_V);
+    len = 0;
+}
+
+void HttpReply::save (uint8_t *state) {
+    flush();
+    EtherCard::httpServerReplySave(state);
+}
+
+void HttpReply::restore (const uint8_t *state) {
+    EtherCard::httpServerReplyRestore(state);
+    len = 0;
+}
+
+WRITE_RESULT HttpReply::write (uint8_t v) {
+    if (!room())
+        flush();
+    EtherCard::tcpOffset()[len++] = v;
+    WRITE_RETURN
+}
+
+WRITE_RESULT HttpReply::write (const uint8_t *buffer, size_t size) {
+#if ARDUINO >= 100
+    size_t n = size;
+#endif
+    while (size) {
+        if (!room())
+            flush();
+        uint16_t cnt = size < room() ? size : room();
+        memcpy(EtherCard::tcpOffset() + len, buffer, cnt);
+        len += cnt;
+        buffer += cnt;
+        size -= cnt;
+    }
+#if ARDUINO >= 100
+    return n;
+#endif
+}
+
 void EtherCard::httpServerReply_with_flags (uint16_t dlen , uint8_t flags) {
     set_seq();
     gPB[TCP_FLAGS_P] = flags; // final packet
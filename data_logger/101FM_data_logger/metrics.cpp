@@ -0,0 +1,157 @@
+/**
+ * Event latency telemetry.
+ *
+ * Two histograms are kept in SRAM:
+ * - capture to commit: μs from the falling edge of the INT line to the record being written to the log.
+ * - commit to delivery: ms from the record being written to it first being sent, one histogram per delivery path.
+ *   DELIVER_HTTP counts /log and /dump, DELIVER_SERIAL the line printed on the serial port and DELIVER_PUSH the line
+ *   sent to a /sub client.
+ *
+ * Buckets are powers of two of the histogram unit, bucket n counting values below 2^n units and the last bucket
+ * everything above. Each histogram also keeps its worst value and the log position of the event that caused it.
+ * The log position is the sequence number with a binary backend and the data EEPROM address of the line otherwise.
+ * LOG_BACKEND_EEPROM_SEQ commits an event when its hot tier migrates it to the 24LC512, and LOG_BACKEND_EEPROM with
+ * POWERFAIL_ADC when log_sync() writes the header for its batch. Their serial and /sub deliveries, which go out right
+ * away and are covered by the last gasp, are mostly not measured then.
+ *
+ * The bus time of the two I2C transactions every event pays for is kept as well: the INTF/INTCAP read of a capture
+ * and the channel name read from the header EEPROM. Both are a register write followed by a read after a repeated
+ * start.
+ *
+ * Finally the longest loop() pass since /metrics last reported it, or since /rec?stall, is kept together with the
+ * captures dropped during it and the start of the request it handled. Every new worst pass of at least STALL_MIN_US
+ * is also marked in the input recorder, which /rec?stall stops right there, so the inputs leading up to it can be
+ * downloaded and played back against a fixed build.
+ */
+
+#include "101FM_data_logger.h"
+
+#define LAT_COMMIT_SHIFT 10 // capture to commit unit is 1024μs
+#define LAT_DELIVER_SHIFT 10 // commit to HTTP delivery unit is 1024ms
+#define LAT_PUSHED_SHIFT 0 // commit to delivery unit of the paths which deliver at once is 1ms
+#define PENDING_LEN 8 // newest committed events, whose deliveries are measured. must be a power of 2
+
+struct LatencyHist lat_commit;
+struct LatencyHist lat_deliver[DELIVER_PATHS];
+uint16_t lat_untracked = 0; // events pushed out of the pending list without any delivery
+struct BusTime bus_capture; // INTF/INTCAP read of a capture
+struct BusTime bus_name; // channel name read of an event
+struct LoopStall loop_stall = { 0, 0, "-" };
+
+static uint32_t pend_id[PENDING_LEN];
+static uint32_t pend_ms[PENDING_LEN];
+static uint8_t pend_done[PENDING_LEN]; // bit n set once the event went out on delivery path n
+static uint8_t pend_head = 0, pend_len = 0;
+
+static void hist_add(struct LatencyHist *h, uint32_t value, uint8_t shift, uint32_t id) {
+    uint32_t units = value >> shift;
+    uint8_t bucket = 0;
+    while (units && bucket < LAT_BUCKETS - 1) {
+        units >>= 1;
+        bucket++;
+    }
+    if (h->count[bucket] != 0xffff) {
+        h->count[bucket]++;
+    }
+    if (value >= h->max) {
+        h->max = value;
+        h->max_id = id;
+    }
+}
+
+/**
+ * Records an event written to the log at position id. tick is micros() at the INT falling edge. Call only once the
+ * write has succeeded.
+ */
+void metrics_commit(uint32_t id, uint32_t tick) {
+    hist_add(&lat_commit, micros() - tick, LAT_COMMIT_SHIFT, id);
+
+    if (pend_len == PENDING_LEN) { // forget the oldest event
+        if (!pend_done[pend_head]) {
+            lat_untracked++;
+        }
+        pend_head = (pend_head + 1) & (PENDING_LEN - 1);
+        pend_len--;
+    }
+    uint8_t slot = (pend_head + pend_len) & (PENDING_LEN - 1);
+    pend_id[slot] = id;
+    pend_ms[slot] = millis();
+    pend_done[slot] = 0;
+    pend_len++;
+}
+
+/**
+ * Called for every record sent out on delivery path path. The first delivery of a pending event on each path ends the
+ * latency measurement of that path.
+ */
+void metrics_delivered(uint32_t id, uint8_t path) {
+    for (uint8_t i = 0; i < pend_len; i++) {
+        uint8_t slot = (pend_head + i) & (PENDING_LEN - 1);
+        if (pend_id[slot] != id) {
+            continue;
+        }
+        if (!(pend_done[slot] & (1 << path))) {
+            hist_add(&lat_deliver[path], millis() - pend_ms[slot],
+                    path == DELIVER_HTTP ? LAT_DELIVER_SHIFT : LAT_PUSHED_SHIFT, id);
+            pend_done[slot] |= 1 << path;
+        }
+        return;
+    }
+}
+
+/**
+ * Adds a transaction which started at micros() since and has just finished.
+ */
+void bus_time(struct BusTime *b, uint32_t since) {
+    uint32_t us = micros() - since;
+    if (b->count == 0xffff) {
+        return;
+    }
+    b->count++;
+    b->sum += us;
+    if (us > b->max) {
+        b->max = us;
+    }
+}
+
+/**
+ * Ends a loop() pass which started at micros() since. drops is the number of captures dropped during it and cause the
+ * request it handled (terminated by CR or NUL), or "-".
+ */
+void loop_time(uint32_t since, uint16_t drops, const char *cause) {
+    uint32_t us = micros() - since;
+    if (us <= loop_stall.max) {
+        return;
+    }
+    loop_stall.max = us;
+    loop_stall.drops = drops;
+    uint8_t i;
+    for (i = 0; i < STALL_CAUSE_LEN && cause[i] && cause[i] != '\r'; i++) {
+        loop_stall.cause[i] = cause[i];
+    }
+    loop_stall.cause[i] = 0;
+    if (us >= STALL_MIN_US) {
+        recorder_stall(us, drops);
+    }
+}
+
+/**
+ * Starts over with the longest loop() pass.
+ */
+void loop_stall_reset() {
+    loop_stall.max = 0;
+    loop_stall.drops = 0;
+    loop_stall.cause[0] = '-';
+    loop_stall.cause[1] = 0;
+}
+
+/**
+ * Formats the buckets of a histogram as one line (no terminator). Returns the length.
+ */
+uint8_t hist_format(const struct LatencyHist *h, const char *name, char *line) {
+    uint8_t len = sprintf(line, "%s", name);
+    for (uint8_t i = 0; i < LAT_BUCKETS; i++) {
+        len += sprintf(line + len, " %u", h->count[i]);
+    }
+    return len;
+}
@@ -0,0 +1,74 @@
+/**
+ * Network driver for the ENC28J60.
+ *
+ * The ENC28J60 is only a MAC. TCP/IP is run on the AVR by EtherCard, which answers ARP and ping and hands TCP
+ * payload to port 80 over to the sketch as requests. A reply is written by HttpReply straight into the packet buffer
+ * and goes out one segment at a time. Nothing is retransmitted.
+ *
+ * The sketch only talks to the chip through the net_* functions here and HttpReply.
+ */
+
+#include "101FM_data_logger.h"
+
+byte Ethernet::buffer[TCP_BUFF_MAX]; // tcp ip send and receive buffer
+
+static uint8_t fin_seen; // the frame of this loop() pass was a FIN or RST
+static uint8_t fin_ip[4];
+static uint8_t fin_port[2];
+
+/**
+ * Resets the chip and sets the addresses. Returns 0 if there is no ENC28J60.
+ */
+uint8_t net_begin(const uint8_t *mac, const uint8_t *ip, const uint8_t *gw) {
+    if (!ether.begin(sizeof Ethernet::buffer, mac, 10)) { // We have connected the chip select on digital 10
+        return 0;
+    }
+    ether.staticSetup(ip, gw);
+    return 1;
+}
+
+/**
+ * Receives a frame and lets EtherCard deal with it. Returns the HTTP request it carried, or NULL.
+ */
+char *net_request() {
+    word len = ether.packetReceive();
+    fin_seen = 0;
+    if (len) {
+        const uint8_t *f = Ethernet::buffer;
+        uint8_t ip = f[ETH_TYPE_H_P] == ETHTYPE_IP_H_V && f[ETH_TYPE_L_P] == ETHTYPE_IP_L_V;
+        uint8_t tcp = ip && len >= HTTP_REPLY_STATE_LEN && f[IP_PROTO_P] == IP_PROTO_TCP_V;
+        recorder_frame(ip ? f[IP_PROTO_P] : 0, len, (f[ETH_TYPE_H_P] << 8) | f[ETH_TYPE_L_P],
+                tcp ? (f[TCP_DST_PORT_H_P] << 8) | f[TCP_DST_PORT_L_P] : 0, tcp ? f[TCP_FLAGS_P] : 0);
+        if (tcp && (f[TCP_FLAGS_P] & (TCP_FLAGS_FIN_V | TCP_FLAGS_RST_V))) {
+            memcpy(fin_ip, f + IP_SRC_P, 4);
+            fin_port[0] = f[TCP_SRC_PORT_H_P];
+            fin_port[1] = f[TCP_SRC_PORT_L_P];
+            fin_seen = 1;
+        }
+    }
+    word pos = ether.packetLoop(len);
+    return pos ? (char *) Ethernet::buffer + pos : NULL;
+}
+
+/**
+ * Tells whether the client of the saved reply reply has closed the connection. EtherCard keeps no connections, so
+ * this only knows about a FIN or RST received in the current loop() pass.
+ */
+uint8_t net_closed(const uint8_t *reply) {
+    return fin_seen && memcmp(fin_ip, reply + IP_DST_P, 4) == 0
+            && fin_port[0] == reply[TCP_DST_PORT_H_P] && fin_port[1] == reply[TCP_DST_PORT_L_P];
+}
+
+/**
+ * Writes len bytes at offset off of 64 byte page page of the scratch memory.
+ */
+void net_scratch_write(uint8_t page, uint8_t off, const uint8_t *data, uint8_t len) {
+    ether.pokeout(page, off, data, len);
+}
+
+/**
+ * Reads the byte at offset off of 64 byte page page of the scratch memory.
+ */
+uint8_t net_scratch_read(uint8_t page, uint8_t off) {
+    return ether.peekin(page, off);
+}
@@ -0,0 +1,156 @@
+/**
+ * Block hashes of the data 24LC512 for reconciling a collector's copy of the log.
+ *
+ * The chip is split into 64 blocks of 1KB and each block is summarised by a CRC16 over its bytes. A collector
+ * compares the hash of a range of blocks (/hashes?from=&to=) with its own copy, narrows down the ranges which differ
+ * and fetches only those blocks (/blk?n=).
+ *
+ * Hashes are cached in SRAM. The log is written strictly in order, so a running CRC follows the block being written
+ * and the block's hash is cached for free the moment its last byte is written. Blocks touched out of order, blocks
+ * written before boot and the block currently being filled are read back from the chip when their hash is asked for.
+ * Reading a block back takes tens of milliseconds, so /hashes does it through hash_fill(), HASH_FILL_BURST bytes per
+ * loop() pass, and replies once every block of the range is cached.
+ */
+
+#include "101FM_data_logger.h"
+
+static uint16_t ph_cache[HASH_BLOCKS];
+static uint8_t ph_valid[HASH_BLOCKS / 8]; // bit set when ph_cache holds the hash of the block
+static uint16_t ph_run; // CRC of the first ph_run_len bytes of block ph_run_block
+static uint16_t ph_run_len = 0;
+static uint8_t ph_run_block;
+static uint8_t ph_fill_block = HASH_BLOCKS; // block hash_fill() is reading back, HASH_BLOCKS if none
+static uint16_t ph_fill_off; // bytes of it read so far
+static uint16_t ph_fill_crc; // CRC of those
+
+static void set_valid(uint8_t block, uint8_t valid) {
+    if (valid) {
+        ph_valid[block >> 3] |= 1 << (block & 7);
+    } else {
+        ph_valid[block >> 3] &= ~(1 << (block & 7));
+    }
+}
+
+/**
+ * Continues crc over len bytes of the data EEPROM starting at addr.
+ */
+static uint16_t crc_chip(uint16_t crc, uint16_t addr, uint16_t len) {
+    uint8_t chunk[32];
+    while (len) {
+        uint8_t cnt = len > sizeof chunk ? sizeof chunk : len;
+        ee_d.readBlock(addr, chunk, cnt);
+        for (uint8_t i = 0; i < cnt; i++) {
+            crc = _crc16_update(crc, chunk[i]);
+        }
+        addr += cnt;
+        len -= cnt;
+    }
+    return crc;
+}
+
+/**
+ * Call after len bytes of data have been written to the data EEPROM at addr. A write must not cross a block boundary.
+ */
+void hash_written(uint16_t addr, const uint8_t *data, uint8_t len) {
+    uint8_t block = addr / HASH_BLOCK_SIZE;
+    uint16_t off = addr % HASH_BLOCK_SIZE;
+    set_valid(block, 0);
+    if (block == ph_fill_block) { // what hash_fill() has read so far is stale
+        ph_fill_block = HASH_BLOCKS;
+    }
+    if (off == 0) { // a new block is started
+        ph_run = 0xffff;
+        ph_run_len = 0;
+        ph_run_block = block;
+    } else if (block != ph_run_block || off != ph_run_len) { // out of order. the running CRC is of no use now.
+        ph_run_len = 0;
+        return;
+    }
+    for (uint8_t i = 0; i < len; i++) {
+        ph_run = _crc16_update(ph_run, data[i]);
+    }
+    ph_run_len += len;
+    if (ph_run_len == HASH_BLOCK_SIZE) {
+        ph_cache[block] = ph_run;
+        set_valid(block, 1);
+        ph_run_len = 0;
+    }
+}
+
+/**
+ * Call when a write to the data EEPROM at addr may have failed half way.
+ */
+void hash_invalidate(uint16_t addr) {
+    uint8_t block = addr / HASH_BLOCK_SIZE;
+    set_valid(block, 0);
+    if (block == ph_fill_block) {
+        ph_fill_block = HASH_BLOCKS;
+    }
+    if (block == ph_run_block) {
+        ph_run_len = 0;
+    }
+}
+
+/**
+ * Hash of a block, read back from the chip if it is not cached.
+ */
+uint16_t hash_block(uint8_t block) {
+    if (ph_valid[block >> 3] & (1 << (block & 7))) {
+        return ph_cache[block];
+    }
+    uint16_t base = block * HASH_BLOCK_SIZE;
+    if (ph_run_len && block == ph_run_block) { // being filled. only the part not written since boot has to be read.
+        return crc_chip(ph_run, base + ph_run_len, HASH_BLOCK_SIZE - ph_run_len);
+    }
+    ph_cache[block] = crc_chip(0xffff, base, HASH_BLOCK_SIZE);
+    set_valid(block, 1);
+    return ph_cache[block];
+}
+
+/**
+ * Reads back at most HASH_FILL_BURST bytes towards the hash of the first block from from to to (inclusive) which is
+ * not cached. Returns 1, without reading anything, once all of them are cached.
+ */
+uint8_t hash_fill(uint8_t from, uint8_t to) {
+    uint8_t block = from;
+    while (ph_valid[block >> 3] & (1 << (block & 7))) {
+        if (block++ == to) {
+            return 1;
+        }
+    }
+    if (block != ph_fill_block) {
+        ph_fill_block = block;
+        if (ph_run_len && block == ph_run_block) { // being filled. only the part not written since boot has to be read.
+            ph_fill_crc = ph_run;
+            ph_fill_off = ph_run_len;
+        } else {
+            ph_fill_crc = 0xffff;
+            ph_fill_off = 0;
+        }
+    }
+    uint16_t len = HASH_BLOCK_SIZE - ph_fill_off;
+    if (len > HASH_FILL_BURST) {
+        len = HASH_FILL_BURST;
+    }
+    ph_fill_crc = crc_chip(ph_fill_crc, block * HASH_BLOCK_SIZE + ph_fill_off, len);
+    ph_fill_off += len;
+    if (ph_fill_off == HASH_BLOCK_SIZE) { // a write to the block resets ph_fill_block, so this is its hash now
+        ph_cache[block] = ph_fill_crc;
+        set_valid(block, 1);
+        ph_fill_block = HASH_BLOCKS;
+    }
+    return 0;
+}
+
+/**
+ * Hash of the blocks from to to (inclusive): CRC16 over their block hashes, lowest block first.
+ */
+uint16_t hash_range(uint8_t from, uint8_t to) {
+    uint16_t crc = 0xffff;
+    for (uint8_t block = from; block <= to; block++) {
+        uint16_t h = hash_block(block);
+        crc = _crc16_update(crc, h & 0xff);
+        crc = _crc16_update(crc, h >> 8);
+    }
+    return crc;
+}
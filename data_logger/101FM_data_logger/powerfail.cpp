@@ -0,0 +1,91 @@
+/**
+ * Power-fail early warning and last-gasp flush.
+ *
+ * The raw supply (before the regulator) is fed through a divider into ADC channel POWERFAIL_ADC. The analog
+ * comparator compares it against the 1.1V bandgap, with the ADC multiplexer standing in for AIN1 (AIN0/AIN1 share
+ * pins with NETLED). The divider is chosen so that the input crosses 1.1V while the regulator still holds VCC, and
+ * the hold-up capacitance must carry the board through the last-gasp writes. At 100kHz, and with I2C_eeprom waiting
+ * out the write cycle (I2C_WRITEDELAY, 6ms) of a chip before its next transfer, they take about 20ms with
+ * LOG_BACKEND_EEPROM and up to 55ms with LOG_BACKEND_EEPROM_SEQ, including the write cycle of the last page.
+ *
+ * When the supply drops below the threshold the comparator interrupt stops capturing (pin change interrupts off) and
+ * flags the power fail. It touches neither bus: it may have cut into an SPI transfer, a TWI transaction or a log
+ * write half way through. powerfail_poll() does the rest at the next safe point of loop(), at the latest once the
+ * record being written is done:
+ * 1. captures still queued are counted as lost.
+ * 2. a power-fail record, carrying the number of lost captures, is appended to the log.
+ * 3. with LOG_BACKEND_EEPROM the data header held back by group commit (log_sync()) is written. Together with the
+ *    record that is two page writes, on the data and on the header 24LC512. With LOG_BACKEND_EEPROM_SEQ the records
+ *    still in the hot tier are migrated, a page write per 8 records.
+ * 4. it waits for the supply to die, or resets the board through the watchdog if it comes back. The watchdog stays
+ *    armed across that reset, so it is disarmed first thing after every reset (wdt_off()).
+ *
+ * The hold-up time has to cover the step of loop() in progress as well as the last-gasp writes.
+ */
+
+#include "101FM_data_logger.h"
+#include <avr/wdt.h>
+#include <util/delay.h>
+
+#ifdef POWERFAIL_ADC
+
+volatile uint8_t powerfail_pending = 0; // set by the comparator interrupt
+
+/**
+ * Disarms the watchdog before anything else runs. After the reset of powerfail_poll() it is still armed at 15ms and
+ * would keep resetting the board long before setup() is done.
+ */
+void wdt_off() __attribute__((naked, used, section(".init3")));
+void wdt_off() {
+    MCUSR = 0;
+    wdt_disable();
+}
+
+/**
+ * Sets the comparator up. The interrupt is taken on the edge of ACO only, so a supply which is still low at boot does
+ * not cause a last gasp until it has been fine and falls again.
+ */
+void powerfail_begin() {
+    ADCSRA &= ~(1 << ADEN);	// the multiplexer only feeds the comparator while the ADC is off
+    ADCSRB |= (1 << ACME);
+    ADMUX = (ADMUX & 0xf0) | POWERFAIL_ADC;
+    DIDR1 |= (1 << AIN1D) | (1 << AIN0D);
+    ACSR = (1 << ACBG) | (1 << ACI);	// bandgap on AIN0, clear a stale interrupt
+    _delay_us(100);	// bandgap start up
+    ACSR |= (1 << ACIS1) | (1 << ACIS0);	// ACO rises when the supply input falls below the bandgap
+    ACSR |= (1 << ACI);
+    ACSR |= (1 << ACIE);
+}
+
+ISR(ANALOG_COMP_vect) {
+    ACSR &= ~(1 << ACIE);	// once only
+    PCICR &= ~(1 << PCIE2);	// stop capturing
+    Timer1.detachInterrupt();
+    PORTD &= ~(EEPLED | SYSLED | NETLED);	// every mA counts now
+    powerfail_pending = 1;
+}
+
+/**
+ * Writes the last gasp if the supply is failing. Call from loop() only where no bus transfer and no log write is in
+ * progress. Does not return then.
+ */
+void powerfail_poll() {
+    if (!powerfail_pending) {
+        return;
+    }
+    recorder_enable(0);
+    uint8_t lost = 0;
+    struct Capture c;
+    while (capture_pop(&c)) {
+        lost++;
+    }
+    log_power_fail(lost);
+
+    while (ACSR & (1 << ACO))
+        ;	// wait for the lights to go out
+    wdt_enable(WDTO_15MS);	// supply came back. start over cleanly.
+    for (;;)
+        ;
+}
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * Input recorder.
+ *
+ * Records the external inputs of the firmware into a ring in the scratch memory of the network chip (with the
+ * ENC28J60 the part of its 8K buffer memory EtherCard keeps for Stash, which this sketch does not use), so a field problem can be played back
+ * against another build. Nothing goes to the EEPROMs and the SRAM cost is a few bytes.
+ *
+ * Every input becomes one 16 byte RecEntry stamped with micros():
+ * 'C' capture    a = bank, b = INTF, c = INTCAP, e = tick of the INT falling edge
+ * 'F' frame      a = IP protocol, b = length, c = ethertype, d = TCP destination port, e = TCP flags. a is 0 unless
+ *                the frame is IPv4, d and e unless it is TCP.
+ * 'T' RTC read   e = unix time
+ * 'S' stall      b = captures dropped, e = μs of a loop() pass longer than any since /metrics or /rec?stall, see
+ *                loop_time()
+ *
+ * /rec?on starts (and empties) the ring, /rec?off stops it and /rec downloads it oldest entry first, one entry per
+ * line as 32 hex digits of the little endian struct, REC_STREAM_BURST entries per loop() pass. The download covers
+ * the entries there were when it started. If the ring is still on and wraps meanwhile, newer entries take the place of
+ * the oldest ones not sent yet. /rec?stall starts it like /rec?on but stops it at the next loop() pass of at least
+ * STALL_MIN_US which is the worst since then, so the ring keeps the inputs which led up to it.
+ */
+
+#include "101FM_data_logger.h"
+
+#define REC_PER_PAGE (64 / sizeof(struct RecEntry))
+#define REC_ENTRIES (REC_PAGES * REC_PER_PAGE)
+
+struct RecEntry {
+    uint32_t time; // micros()
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+    uint16_t c;
+    uint16_t d;
+    uint32_t e;
+};
+
+static uint8_t rec_on = 0; // 2 while waiting for a stall
+static uint16_t rec_next = 0; // next entry to write
+static uint8_t rec_wrapped = 0;
+
+void recorder_enable(uint8_t on) {
+    if (on && !rec_on) {
+        rec_next = 0;
+        rec_wrapped = 0;
+    }
+    rec_on = on;
+}
+
+static void rec_put(uint8_t type, uint8_t a, uint16_t b, uint16_t c, uint16_t d, uint32_t e) {
+    if (!rec_on) {
+        return;
+    }
+    struct RecEntry r;
+    r.time = micros();
+    r.type = type;
+    r.a = a;
+    r.b = b;
+    r.c = c;
+    r.d = d;
+    r.e = e;
+    net_scratch_write(rec_next / REC_PER_PAGE, (rec_next % REC_PER_PAGE) * sizeof r, (uint8_t*) &r, sizeof r);
+    if (++rec_next == REC_ENTRIES) {
+        rec_next = 0;
+        rec_wrapped = 1;
+    }
+}
+
+void recorder_capture(const struct Capture *c) {
+    rec_put('C', c->bank, c->intf, c->intcap, 0, c->tick);
+}
+
+/**
+ * Records the headers of a frame just received, as told by the network driver.
+ */
+void recorder_frame(uint8_t proto, uint16_t len, uint16_t type, uint16_t port, uint8_t flags) {
+    rec_put('F', proto, len, type, port, flags);
+}
+
+/**
+ * Marks a new worst loop() pass. Stops the ring if it was started by /rec?stall.
+ */
+void recorder_stall(uint32_t us, uint16_t drops) {
+    rec_put('S', 0, drops, 0, 0, us);
+    if (rec_on == 2) {
+        rec_on = 0;
+    }
+}
+
+/**
+ * DS3231_get() which records what the RTC said.
+ */
+void rtc_get(struct ts *tm) {
+    DS3231_get(tm);
+    rec_put('T', 0, 0, 0, 0, tm->unixtime);
+}
+
+/**
+ * Number of entries in the ring.
+ */
+uint16_t recorder_count() {
+    return rec_wrapped ? REC_ENTRIES : rec_next;
+}
+
+/**
+ * Slot of the oldest entry in the ring.
+ */
+uint16_t recorder_oldest() {
+    return rec_wrapped ? rec_next : 0;
+}
+
+/**
+ * Formats entry n counted from slot first (see recorder_oldest()) as 32 hex digits (no terminator).
+ */
+void recorder_format(uint16_t first, uint16_t n, char *line) {
+    uint16_t idx = (first + n) % REC_ENTRIES;
+    uint8_t page = idx / REC_PER_PAGE;
+    uint8_t off = (idx % REC_PER_PAGE) * sizeof(struct RecEntry);
+    for (uint8_t i = 0; i < sizeof(struct RecEntry); i++) {
+        sprintf(line + 2 * i, "%02x", net_scratch_read(page, off + i));
+    }
+}
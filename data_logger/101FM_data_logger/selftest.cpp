@@ -0,0 +1,164 @@
+/**
+ * On-device load self test.
+ *
+ * Synthetic pin transitions are pushed into the capture queue at a fixed rate, exactly where the pin change ISR puts
+ * real captures. From there they take the real path through handleCapture() and record_event(): channel name lookup,
+ * formatting and the serial echo. Only the final write is redirected. Instead of the log it goes to a scratch area
+ * on the header 24LC512 (SELFTEST_START to SELFTEST_END), which is the same part on the same bus as the data EEPROM.
+ * The production log is never touched, and real events keep being logged while a test runs.
+ *
+ * Injection runs from loop(). Every event that is due is pushed in one go, so while a commit keeps loop() busy the
+ * queue fills the same way it would under a burst of real interrupts. The tick of a synthetic capture is the time it
+ * was due, so the latency figures include the time it waited to be injected.
+ *
+ * Patterns:
+ * w - walking. One pin changes per event, pins taken in turn.
+ * a - all. All 16 pins of the bank change at once (16 records per event).
+ * r - random. A pseudo random set of pins changes per event.
+ */
+
+#include "101FM_data_logger.h"
+
+#define SELFTEST_IDLE 0
+#define SELFTEST_RUNNING 1
+#define SELFTEST_DONE 2
+
+static uint8_t st_state = SELFTEST_IDLE;
+static char st_pattern;
+static uint16_t st_count; // events to inject
+static uint16_t st_injected; // events pushed into the capture queue
+static uint16_t st_drops; // events rejected by a full queue
+static uint32_t st_records; // records expected from the injected events. up to 16 per event
+static uint32_t st_committed; // records written to the scratch area
+static uint32_t st_errors; // failed scratch writes
+static uint16_t st_bus_errors; // expander bus errors at the start of the test
+static uint16_t st_twi_errors; // TWI bus errors at the start of the test
+static uint32_t st_interval; // μs between events
+static uint32_t st_due; // micros() at which the next event is due
+static uint32_t st_start; // millis() at start
+static uint32_t st_end; // millis() at the last commit
+static uint32_t st_lat_sum; // capture to commit, μs
+static uint32_t st_lat_max;
+static uint16_t st_pins; // current state of the synthetic pins
+static uint16_t st_lfsr;
+static uint16_t st_slot; // next write position in the scratch area
+
+/**
+ * Starts a test of count events at rate events per second. Returns 0 if the parameters are out of range or a test
+ * is already running.
+ */
+uint8_t selftest_start(uint16_t rate, uint16_t count, char pattern) {
+    if (st_state == SELFTEST_RUNNING || rate < 1 || rate > 1000 || count < 1 || count > 10000
+            || (pattern != 'w' && pattern != 'a' && pattern != 'r')) {
+        return 0;
+    }
+    st_pattern = pattern;
+    st_count = count;
+    st_injected = 0;
+    st_drops = 0;
+    st_records = 0;
+    st_committed = 0;
+    st_errors = 0;
+#ifdef EXPANDER_SOFT_I2C
+    st_bus_errors = expbus.errors;
+#else
+    st_bus_errors = 0;
+#endif
+    st_twi_errors = Wire.errors();
+    st_lat_sum = 0;
+    st_lat_max = 0;
+    st_pins = 0;
+    st_lfsr = 0xace1;
+    st_slot = 0;
+    st_interval = 1000000UL / rate;
+    st_start = millis();
+    st_end = st_start;
+    st_due = micros();
+    st_state = SELFTEST_RUNNING;
+    return 1;
+}
+
+/**
+ * Injects every event which is due. Call from loop().
+ */
+void selftest_poll() {
+    if (st_state != SELFTEST_RUNNING) {
+        return;
+    }
+    while (st_injected < st_count && (int32_t) (micros() - st_due) >= 0) {
+        uint16_t intf;
+        if (st_pattern == 'w') {
+            intf = 1 << (st_injected & 0x0f);
+        } else if (st_pattern == 'a') {
+            intf = 0xffff;
+        } else {
+            st_lfsr = (st_lfsr >> 1) ^ (-(st_lfsr & 1) & 0xb400); // 16 bit Galois LFSR
+            intf = st_lfsr ? st_lfsr : 1;
+        }
+        st_pins ^= intf;
+        if (capture_push(CAPTURE_SELFTEST | (st_injected & 1), intf, st_pins, st_due)) {
+            for (uint16_t m = intf; m; m &= m - 1) {
+                st_records++;
+            }
+        } else {
+            st_drops++;
+        }
+        st_injected++;
+        st_due += st_interval;
+    }
+    if (st_injected == st_count && st_committed + st_errors >= st_records) {
+        st_state = SELFTEST_DONE;
+    }
+}
+
+/**
+ * Final step of record_event() for synthetic events. data is what the log backend would have written.
+ */
+void selftest_commit(const uint8_t *data, uint8_t len, uint32_t tick) {
+    uint16_t addr = SELFTEST_START + st_slot * len;
+    if (addr + len > SELFTEST_END) {
+        addr = SELFTEST_START;
+        st_slot = 0;
+    }
+    st_slot++;
+    PORTD |= EEPLED;	// turn on EEPLED to show eeprom usage
+    if (ee_h.writeBlock(addr, (uint8_t*) data, len)) {
+        st_errors++;
+    } else {
+        uint32_t lat = micros() - tick;
+        st_lat_sum += lat;
+        if (lat > st_lat_max) {
+            st_lat_max = lat;
+        }
+        st_committed++;
+    }
+    PORTD &= ~EEPLED;	// turn off EEPLED
+    st_end = millis();
+}
+
+/**
+ * Formats line n (0 to 2) of the test report. Returns the length or 0 past the last line.
+ *
+ * ST <state> INJ <events injected> DROP <events dropped> REC <records committed>/<records expected>
+ * ERR <failed scratch writes> BUS <I2C transactions failed on either bus> TIME <ms> RATE <records per second>
+ * LAT AVG <μs> MAX <μs>
+ */
+uint8_t selftest_report(uint8_t n, char *line) {
+    static const char states[] = "IRD"; // idle, running, done
+    uint32_t elapsed = st_end - st_start;
+    uint16_t bus = Wire.errors() - st_twi_errors;
+#ifdef EXPANDER_SOFT_I2C
+    bus += expbus.errors - st_bus_errors;
+#endif
+    switch (n) {
+    case 0:
+        return sprintf(line, "ST %c INJ %u DROP %u REC %lu/%lu\n", states[st_state], st_injected, st_drops, st_committed,
+                st_records);
+    case 1:
+        return sprintf(line, "ERR %lu BUS %u TIME %lu RATE %lu\n", st_errors, bus, elapsed,
+                elapsed ? st_committed * 1000UL / elapsed : 0);
+    case 2:
+        return sprintf(line, "LAT AVG %lu MAX %lu\n", st_committed ? st_lat_sum / st_committed : 0, st_lat_max);
+    }
+    return 0;
+}
@@ -0,0 +1,230 @@
+/**
+ * Live event subscriptions.
+ *
+ * A client opens GET /sub?t=<bank>/<channel>/<state> and keeps the connection open. Every event logged from then on
+ * whose topic matches the filter is sent to it as one line as soon as loop() gets round to it:
+ *
+ * <bank>/<channel>/<state> <unix time> <LOG_REC_* flags>
+ *
+ * A level of the filter is a decimal number, + for any value of that level, or # (last level only) for any value of
+ * it and the levels below. For a channel group the channel is its first pin and the state its decoded value.
+ * Examples: 1/+/1 (any pin of BANK 1 going high), 0/4/# (everything on BANK 0 pin 4), # (everything).
+ * # has to be sent URL encoded as %23, + may be sent as %2B.
+ *
+ * The topic space is small and fixed, so a filter is compiled into a 32 bit channel mask and a 16 bit state mask
+ * when it is subscribed. Fanning an event out is then one bit test per subscriber.
+ *
+ * Each subscriber has a small queue. Publishing never waits: when the queue of a subscriber is full the event is
+ * dropped for that subscriber only and the next line it gets tells how many it missed. At most SUB_BURST lines per
+ * subscriber go out per loop() pass. A subscription ends when the client closes the connection, or when a new
+ * client finds every slot taken, in which case the oldest subscriber is let go.
+ *
+ * An event carries its log position, so the commit to delivery latency of the push path is measured once its line
+ * has been handed to the network chip.
+ */
+
+#include "101FM_data_logger.h"
+
+#define SUB_STATES 16 // states a filter can tell apart. group values above this only match +
+
+struct SubEvent {
+	uint32_t id; // log position, METRICS_NO_ID if the event did not make it into the log
+	uint32_t time;
+	uint8_t bank;
+	uint8_t pin;
+	uint8_t val;
+	uint8_t flags;
+};
+
+struct Subscriber {
+	uint8_t active;
+	uint32_t since; // millis() when subscribed
+	uint32_t channels; // bit bank * 16 + pin set when the channel matches
+	uint16_t states; // bit n set when state n matches
+	uint8_t any_state; // state level is + or #
+	uint16_t dropped; // events missed since the last line sent
+	uint8_t head, len;
+	struct SubEvent queue[SUB_QUEUE_LEN];
+	uint8_t reply[HTTP_REPLY_STATE_LEN]; // see HttpReply::save()
+};
+
+static struct Subscriber subs[SUB_MAX];
+
+/**
+ * Parses one level of a filter. Returns the number of characters taken, or 0 if the level is not valid.
+ * *value is set to the number, or to 0xff for + and 0xfe for #.
+ */
+static uint8_t parse_level(const char *s, uint8_t *value) {
+    if (*s == '+' || *s == '#') {
+        *value = *s == '+' ? 0xff : 0xfe;
+        return 1;
+    }
+    if (strncmp_P(s, PSTR("%2B"), 3) == 0 || strncmp_P(s, PSTR("%23"), 3) == 0) { // URL encoded
+        *value = s[2] == 'B' ? 0xff : 0xfe;
+        return 3;
+    }
+    uint8_t n = 0;
+    uint16_t v = 0;
+    while (s[n] >= '0' && s[n] <= '9' && n < 3) {
+        v = v * 10 + s[n] - '0';
+        n++;
+    }
+    if (!n || v > 0xfd) {
+        return 0;
+    }
+    *value = v;
+    return n;
+}
+
+/**
+ * Compiles filter (terminated by a space) into sub. Returns 0 if it is not valid.
+ */
+static uint8_t compile_filter(const char *filter, struct Subscriber *sub) {
+    uint8_t level[3];
+    uint8_t depth = 0;
+    const char *s = filter;
+    for (;;) {
+        uint8_t n = parse_level(s, &level[depth]);
+        if (!n) {
+            return 0;
+        }
+        s += n;
+        if (level[depth++] == 0xfe) { // # swallows the rest
+            while (depth < 3) {
+                level[depth++] = 0xff;
+            }
+            break;
+        }
+        if (*s != '/' || depth == 3) {
+            break;
+        }
+        s++;
+    }
+    if (*s != ' ' || depth != 3) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < 3; i++) {
+        if (level[i] == 0xfe) {
+            level[i] = 0xff;
+        }
+    }
+    if ((level[0] != 0xff && level[0] > 1) || (level[1] != 0xff && level[1] > 15)) {
+        return 0;
+    }
+    uint16_t pins = level[1] == 0xff ? 0xffff : 1 << level[1];
+    sub->channels = 0;
+    if (level[0] != 1) {
+        sub->channels |= pins;
+    }
+    if (level[0] != 0) {
+        sub->channels |= (uint32_t) pins << 16;
+    }
+    sub->any_state = level[2] == 0xff;
+    sub->states = sub->any_state ? 0xffff : level[2] < SUB_STATES ? 1 << level[2] : 0;
+    return 1;
+}
+
+/**
+ * Ends subscription s with a FIN.
+ */
+static void sub_close(uint8_t s) {
+    HttpReply out;
+    out.restore(subs[s].reply);
+    out.close(); // Send final packet with FIN which ends the TCP transmission.
+    subs[s].active = 0;
+}
+
+/**
+ * Returns 0 if filter (terminated by a space) is not a valid topic filter.
+ */
+uint8_t sub_filter_valid(const char *filter) {
+    struct Subscriber sub;
+    return compile_filter(filter, &sub);
+}
+
+/**
+ * Subscribes the client of the reply state reply (see HttpReply::save()) to filter, which must be
+ * valid. The HTTP header must have been sent already.
+ */
+void sub_open(const char *filter, const uint8_t *reply) {
+    uint8_t s, oldest = 0;
+    for (s = 0; s < SUB_MAX && subs[s].active; s++) {
+        if (millis() - subs[s].since > millis() - subs[oldest].since) {
+            oldest = s;
+        }
+    }
+    if (s == SUB_MAX) { // every slot is taken. whoever has been around longest makes way.
+        s = oldest;
+        sub_close(s);
+    }
+    struct Subscriber *sub = &subs[s];
+    compile_filter(filter, sub);
+    sub->dropped = 0;
+    sub->head = 0;
+    sub->len = 0;
+    sub->since = millis();
+    memcpy(sub->reply, reply, HTTP_REPLY_STATE_LEN);
+    sub->active = 1;
+}
+
+/**
+ * Hands an event over to the subscribers whose filter matches it. Never blocks.
+ */
+void sub_publish(uint8_t bank, uint8_t pin, uint8_t val, uint8_t flags, uint32_t time, uint32_t id) {
+    uint32_t channel = 1UL << (bank * 16 + pin);
+    for (uint8_t s = 0; s < SUB_MAX; s++) {
+        struct Subscriber *sub = &subs[s];
+        if (!sub->active || !(sub->channels & channel)
+                || !(sub->any_state || (val < SUB_STATES && (sub->states & (1 << val))))) {
+            continue;
+        }
+        if (sub->len == SUB_QUEUE_LEN) { // slow consumer. it loses the event, ingest does not wait.
+            if (sub->dropped != 0xffff) {
+                sub->dropped++;
+            }
+            continue;
+        }
+        struct SubEvent *e = &sub->queue[(sub->head + sub->len) % SUB_QUEUE_LEN];
+        e->id = id;
+        e->time = time;
+        e->bank = bank;
+        e->pin = pin;
+        e->val = val;
+        e->flags = flags;
+        sub->len++;
+    }
+}
+
+/**
+ * Sends up to SUB_BURST queued events to each subscriber. Call from loop().
+ */
+void sub_poll() {
+    HttpReply out;
+    for (uint8_t s = 0; s < SUB_MAX; s++) {
+        struct Subscriber *sub = &subs[s];
+        if (sub->active && net_closed(sub->reply)) {
+            sub->active = 0; // the network driver answers the FIN itself
+        }
+        if (!sub->active || (!sub->len && !sub->dropped)) {
+            continue;
+        }
+        out.restore(sub->reply);
+        if (sub->dropped) {
+            out.printf("%u dropped\n", sub->dropped);
+            sub->dropped = 0;
+        }
+        uint32_t sent[SUB_BURST];
+        uint8_t n;
+        for (n = 0; n < SUB_BURST && sub->len; n++) {
+            const struct SubEvent *e = &sub->queue[sub->head];
+            out.printf("%u/%u/%u %lu %u\n", e->bank, e->pin, e->val, e->time, e->flags);
+            sent[n] = e->id;
+            sub->head = (sub->head + 1) % SUB_QUEUE_LEN;
+            sub->len--;
+        }
+        out.save(sub->reply); // the lines go out together
+        while (n) {
+            metrics_delivered(sent[--n], DELIVER_PUSH);
+        }
+    }
+}